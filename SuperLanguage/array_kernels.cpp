@@ -0,0 +1,669 @@
+#include "array_kernels.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <limits>
+#include <span>
+#include <string_view>
+
+#include "log.hpp"
+#include "simd.hpp"
+
+namespace
+{
+	using ElementType = ArrayObj::ElementType;
+
+	// Packed int results beyond int are reported rather than wrapped
+	bool fits_int(int64_t value)
+	{
+		return value >= std::numeric_limits<int>::min() && value <= std::numeric_limits<int>::max();
+	}
+
+	// Integer loops vectorize on their own, independent accumulators
+	// only keep the dependency chain short for scalar builds.
+	int64_t sum_ints(std::span<const int> values)
+	{
+		int64_t acc[4] = {};
+		size_t i = 0;
+		for (; i + 4 <= values.size(); i += 4)
+		{
+			acc[0] += values[i];
+			acc[1] += values[i + 1];
+			acc[2] += values[i + 2];
+			acc[3] += values[i + 3];
+		}
+		for (; i < values.size(); ++i)
+		{
+			acc[0] += values[i];
+		}
+		return acc[0] + acc[1] + acc[2] + acc[3];
+	}
+
+	int64_t dot_ints(std::span<const int> left, std::span<const int> right)
+	{
+		int64_t acc = 0;
+		for (size_t i = 0; i < left.size(); ++i)
+		{
+			acc += static_cast<int64_t>(left[i]) * right[i];
+		}
+		return acc;
+	}
+
+	// Float reductions are not reassociated by the compiler, so the lanes
+	// are spelled out. Partial sums are kept in double to bound the error
+	// on long arrays.
+	double sum_floats(std::span<const float> values)
+	{
+		size_t i = 0;
+		double res = 0.0;
+#if HAS_SSE2
+		__m128d acc0 = _mm_setzero_pd();
+		__m128d acc1 = _mm_setzero_pd();
+		for (; i + 4 <= values.size(); i += 4)
+		{
+			const __m128 v = _mm_loadu_ps(values.data() + i);
+			acc0 = _mm_add_pd(acc0, _mm_cvtps_pd(v));
+			acc1 = _mm_add_pd(acc1, _mm_cvtps_pd(_mm_movehl_ps(v, v)));
+		}
+		double lanes[2];
+		_mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+		res = lanes[0] + lanes[1];
+#endif
+		for (; i < values.size(); ++i)
+		{
+			res += values[i];
+		}
+		return res;
+	}
+
+	double dot_floats(std::span<const float> left, std::span<const float> right)
+	{
+		size_t i = 0;
+		double res = 0.0;
+#if HAS_SSE2
+		__m128d acc0 = _mm_setzero_pd();
+		__m128d acc1 = _mm_setzero_pd();
+		for (; i + 4 <= left.size(); i += 4)
+		{
+			const __m128 v = _mm_mul_ps(_mm_loadu_ps(left.data() + i), _mm_loadu_ps(right.data() + i));
+			acc0 = _mm_add_pd(acc0, _mm_cvtps_pd(v));
+			acc1 = _mm_add_pd(acc1, _mm_cvtps_pd(_mm_movehl_ps(v, v)));
+		}
+		double lanes[2];
+		_mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+		res = lanes[0] + lanes[1];
+#endif
+		for (; i < left.size(); ++i)
+		{
+			res += left[i] * right[i];
+		}
+		return res;
+	}
+
+	template <bool Min>
+	float reduce_floats(std::span<const float> values)
+	{
+		size_t i = 0;
+		float res = values.front();
+#if HAS_SSE2
+		if (values.size() >= 4)
+		{
+			__m128 acc = _mm_loadu_ps(values.data());
+			for (i = 4; i + 4 <= values.size(); i += 4)
+			{
+				const __m128 v = _mm_loadu_ps(values.data() + i);
+				acc = Min ? _mm_min_ps(acc, v) : _mm_max_ps(acc, v);
+			}
+			float lanes[4];
+			_mm_storeu_ps(lanes, acc);
+			res = Min ? std::min({ lanes[0], lanes[1], lanes[2], lanes[3] }) : std::max({ lanes[0], lanes[1], lanes[2], lanes[3] });
+		}
+#endif
+		for (; i < values.size(); ++i)
+		{
+			res = Min ? std::min(res, values[i]) : std::max(res, values[i]);
+		}
+		return res;
+	}
+
+	std::optional<Number> get_number(const ArrayObj& arr, size_t index)
+	{
+		const auto element = arr.get_element(index);
+		std::optional<Number> number;
+		if (element)
+		{
+			number = Number::get_from_object(element);
+		}
+		if (!number)
+		{
+			LOG_ERROR("Array element {} is not a number", index);
+		}
+		return number;
+	}
+
+	template <bool Min>
+	ObjectPtr reduce(ArrayObj& arr)
+	{
+		if (arr.size() == 0)
+		{
+			return {};
+		}
+
+		switch (arr.get_element_type())
+		{
+		case ElementType::Int:
+			{
+				const auto ints = arr.get_ints();
+				return Integer::make(Min ? *std::min_element(ints.begin(), ints.end()) : *std::max_element(ints.begin(), ints.end()));
+			}
+		case ElementType::Float:
+			return make_object<Float>(reduce_floats<Min>(arr.get_floats()));
+		default:
+			break;
+		}
+
+		size_t best_index = 0;
+		auto best = get_number(arr, 0);
+		for (size_t i = 1; best && i < arr.size(); ++i)
+		{
+			const auto value = get_number(arr, i);
+			if (!value)
+			{
+				return {};
+			}
+			if (Min ? value->perform_bool_op<LessOp>(*best) : value->perform_bool_op<GreaterOp>(*best))
+			{
+				best = value;
+				best_index = i;
+			}
+		}
+		return best ? arr.get_element(best_index) : ObjectPtr{};
+	}
+
+	// Below this size std::sort beats the four counting passes
+	constexpr size_t radix_sort_threshold = 256;
+
+	// Maps values to unsigned keys with the same ordering
+	uint32_t to_radix_key(int v) { return static_cast<uint32_t>(v) ^ 0x80000000u; }
+	uint32_t to_radix_key(float v)
+	{
+		const auto bits = std::bit_cast<uint32_t>(v);
+		return (bits & 0x80000000u) ? ~bits : bits | 0x80000000u;
+	}
+
+	void from_radix_key(uint32_t key, int& v) { v = static_cast<int>(key ^ 0x80000000u); }
+	void from_radix_key(uint32_t key, float& v)
+	{
+		v = std::bit_cast<float>((key & 0x80000000u) ? key ^ 0x80000000u : ~key);
+	}
+
+	// LSD radix sort, one byte per pass. Passes where every key falls into
+	// the same bucket are skipped.
+	template <class T>
+	void radix_sort(std::span<T> values)
+	{
+		if (values.size() < radix_sort_threshold)
+		{
+			// Same order as the radix passes, NaN included where < is no strict order
+			std::sort(values.begin(), values.end(), [](T l, T r) { return to_radix_key(l) < to_radix_key(r); });
+			return;
+		}
+
+		std::vector<uint32_t> keys(values.size());
+		std::vector<uint32_t> buffer(values.size());
+		std::array<std::array<size_t, 256>, 4> counts = {};
+		for (size_t i = 0; i < values.size(); ++i)
+		{
+			const auto key = to_radix_key(values[i]);
+			keys[i] = key;
+			for (size_t pass = 0; pass < 4; ++pass)
+			{
+				++counts[pass][(key >> (pass * 8)) & 0xFF];
+			}
+		}
+
+		for (size_t pass = 0; pass < 4; ++pass)
+		{
+			auto& count = counts[pass];
+			const auto shift = pass * 8;
+			if (count[(keys[0] >> shift) & 0xFF] == keys.size())
+			{
+				continue;
+			}
+
+			size_t offset = 0;
+			for (auto& c : count)
+			{
+				const auto n = c;
+				c = offset;
+				offset += n;
+			}
+			for (const auto key : keys)
+			{
+				buffer[count[(key >> shift) & 0xFF]++] = key;
+			}
+			keys.swap(buffer);
+		}
+
+		for (size_t i = 0; i < values.size(); ++i)
+		{
+			from_radix_key(keys[i], values[i]);
+		}
+	}
+
+	// Sort keys of generic arrays: numbers compare as double, which holds
+	// every int and float exactly, strings compare bytewise.
+	bool get_sort_key(const ObjectPtr& obj, double& out)
+	{
+		if (const auto ival = obj->get_inner<int>())
+		{
+			out = *ival;
+			return true;
+		}
+		if (const auto fval = obj->get_inner<float>())
+		{
+			out = *fval;
+			return true;
+		}
+		return false;
+	}
+
+	bool get_sort_key(const ObjectPtr& obj, std::string_view& out)
+	{
+		return obj->get(&out);
+	}
+
+	template <class Key>
+	bool sort_objects(std::vector<ObjectPtr>& objects, bool stable)
+	{
+		// Keys are extracted once, comparisons never go through virtual calls
+		std::vector<std::pair<Key, ObjectPtr>> entries;
+		entries.reserve(objects.size());
+		for (size_t i = 0; i < objects.size(); ++i)
+		{
+			Key key;
+			if (!get_sort_key(objects[i], key))
+			{
+				LOG_ERROR("Array element {} can't be compared with element 0", i);
+				return false;
+			}
+			entries.emplace_back(key, objects[i]);
+		}
+
+		const auto less = [](const auto& left, const auto& right) { return left.first < right.first; };
+		if (stable)
+		{
+			std::stable_sort(entries.begin(), entries.end(), less);
+		}
+		else
+		{
+			std::sort(entries.begin(), entries.end(), less);
+		}
+
+		for (size_t i = 0; i < objects.size(); ++i)
+		{
+			objects[i] = std::move(entries[i].second);
+		}
+		return true;
+	}
+
+	template <class Key>
+	int search_objects(const std::vector<ObjectPtr>& objects, Key value)
+	{
+		const auto it = std::lower_bound(objects.begin(), objects.end(), value, [](const ObjectPtr& obj, Key v)
+			{
+				Key key;
+				return get_sort_key(obj, key) && key < v;
+			});
+		Key key;
+		if (it != objects.end() && get_sort_key(*it, key) && key == value)
+		{
+			return static_cast<int>(it - objects.begin());
+		}
+		return -1;
+	}
+
+	template <class T, class V>
+	int search_values(std::span<const T> values, V value)
+	{
+		const auto it = std::lower_bound(values.begin(), values.end(), value, [](T element, V v) { return element < v; });
+		if (it != values.end() && *it == value)
+		{
+			return static_cast<int>(it - values.begin());
+		}
+		return -1;
+	}
+
+	bool same_values(const ObjectPtr& left, const ObjectPtr& right)
+	{
+		double lnum, rnum;
+		if (get_sort_key(left, lnum) && get_sort_key(right, rnum))
+		{
+			return lnum == rnum;
+		}
+		std::string_view lstr, rstr;
+		if (get_sort_key(left, lstr) && get_sort_key(right, rstr))
+		{
+			return lstr == rstr;
+		}
+		return left == right;
+	}
+
+	template <class T>
+	size_t unique_values(std::span<T> values)
+	{
+		return std::unique(values.begin(), values.end()) - values.begin();
+	}
+}
+
+namespace array_kernels
+{
+	std::optional<Number> sum(ArrayObj& arr)
+	{
+		switch (arr.get_element_type())
+		{
+		case ElementType::Int:
+			{
+				const auto total = sum_ints(arr.get_ints());
+				if (!fits_int(total))
+				{
+					LOG_ERROR("Array sum {} overflows int", total);
+					return {};
+				}
+				return Number{ static_cast<int>(total) };
+			}
+		case ElementType::Float:	return Number{ static_cast<float>(sum_floats(arr.get_floats())) };
+		default:					break;
+		}
+
+		Number res;
+		for (size_t i = 0; i < arr.size(); ++i)
+		{
+			const auto value = get_number(arr, i);
+			if (!value)
+			{
+				return {};
+			}
+			res = res.perform_op<PlusOp>(*value);
+		}
+		return res;
+	}
+
+	std::optional<Number> dot(ArrayObj& left, ArrayObj& right)
+	{
+		if (left.size() != right.size())
+		{
+			LOG_ERROR("Array sizes differ: {} and {}", left.size(), right.size());
+			return {};
+		}
+
+		const auto left_type = left.get_element_type();
+		const auto right_type = right.get_element_type();
+		if (left_type == ElementType::Int && right_type == ElementType::Int)
+		{
+			const auto total = dot_ints(left.get_ints(), right.get_ints());
+			if (!fits_int(total))
+			{
+				LOG_ERROR("Array dot product {} overflows int", total);
+				return {};
+			}
+			return Number{ static_cast<int>(total) };
+		}
+		if (left_type == ElementType::Float && right_type == ElementType::Float)
+		{
+			return Number{ static_cast<float>(dot_floats(left.get_floats(), right.get_floats())) };
+		}
+
+		Number res;
+		for (size_t i = 0; i < left.size(); ++i)
+		{
+			const auto l = get_number(left, i);
+			const auto r = get_number(right, i);
+			if (!l || !r)
+			{
+				return {};
+			}
+			res = res.perform_op<PlusOp>(l->perform_op<MulOp>(*r));
+		}
+		return res;
+	}
+
+	ObjectPtr min(ArrayObj& arr)
+	{
+		return reduce<true>(arr);
+	}
+
+	ObjectPtr max(ArrayObj& arr)
+	{
+		return reduce<false>(arr);
+	}
+
+	bool scale(ArrayObj& arr, Number factor)
+	{
+		if (arr.get_element_type() == ElementType::Int && !factor.is_int() && !arr.promote_to_floats())
+		{
+			return false;
+		}
+
+		switch (arr.get_element_type())
+		{
+		case ElementType::Int:
+			{
+				const int k = factor.as_int();
+				// Products are monotonic in the element, the extremes decide
+				if (const auto ints = arr.get_ints(); !ints.empty())
+				{
+					const auto [low, high] = std::minmax_element(ints.begin(), ints.end());
+					if (!fits_int(static_cast<int64_t>(*low) * k) || !fits_int(static_cast<int64_t>(*high) * k))
+					{
+						LOG_ERROR("Scaling array by {} overflows int", k);
+						return false;
+					}
+				}
+				for (auto& v : arr.edit_ints())
+				{
+					v *= k;
+				}
+				return true;
+			}
+		case ElementType::Float:
+			{
+				const float k = factor.as_float();
+				for (auto& v : arr.edit_floats())
+				{
+					v *= k;
+				}
+				return true;
+			}
+		default:
+			break;
+		}
+
+		for (size_t i = 0; i < arr.size(); ++i)
+		{
+			const auto value = get_number(arr, i);
+			if (!value)
+			{
+				return false;
+			}
+			arr.set_element(i, value->perform_op<MulOp>(factor).as_object());
+		}
+		return true;
+	}
+
+	bool add(ArrayObj& dst, ArrayObj& src)
+	{
+		if (dst.size() != src.size())
+		{
+			LOG_ERROR("Array sizes differ: {} and {}", dst.size(), src.size());
+			return false;
+		}
+
+		if (dst.get_element_type() == ElementType::Int && src.get_element_type() == ElementType::Float && !dst.promote_to_floats())
+		{
+			return false;
+		}
+
+		const auto dst_type = dst.get_element_type();
+		const auto src_type = src.get_element_type();
+		if (dst_type == ElementType::Int && src_type == ElementType::Int)
+		{
+			const auto s = src.get_ints();
+			// Checked before writing, the array is left as it was
+			const auto current = dst.get_ints();
+			for (size_t i = 0; i < current.size(); ++i)
+			{
+				if (!fits_int(static_cast<int64_t>(current[i]) + s[i]))
+				{
+					LOG_ERROR("Adding array element {} overflows int", i);
+					return false;
+				}
+			}
+
+			const auto d = dst.edit_ints();
+			for (size_t i = 0; i < d.size(); ++i)
+			{
+				d[i] += s[i];
+			}
+			return true;
+		}
+		if (dst_type == ElementType::Float && src_type == ElementType::Float)
+		{
+			const auto d = dst.edit_floats();
+			const auto s = src.get_floats();
+			for (size_t i = 0; i < d.size(); ++i)
+			{
+				d[i] += s[i];
+			}
+			return true;
+		}
+		if (dst_type == ElementType::Float && src_type == ElementType::Int)
+		{
+			const auto d = dst.edit_floats();
+			const auto s = src.get_ints();
+			for (size_t i = 0; i < d.size(); ++i)
+			{
+				d[i] += static_cast<float>(s[i]);
+			}
+			return true;
+		}
+
+		for (size_t i = 0; i < dst.size(); ++i)
+		{
+			const auto l = get_number(dst, i);
+			const auto r = get_number(src, i);
+			if (!l || !r)
+			{
+				return false;
+			}
+			dst.set_element(i, l->perform_op<PlusOp>(*r).as_object());
+		}
+		return true;
+	}
+
+	bool sort(ArrayObj& arr, bool stable)
+	{
+		switch (arr.get_element_type())
+		{
+		case ElementType::Empty:	return true;
+		case ElementType::Int:		radix_sort(arr.edit_ints());	return true;
+		case ElementType::Float:	radix_sort(arr.edit_floats());	return true;
+		case ElementType::Bool:
+			{
+				const auto bools = arr.edit_bools();
+				const auto falses = std::count(bools.begin(), bools.end(), 0);
+				std::fill(bools.begin(), bools.begin() + falses, 0);
+				std::fill(bools.begin() + falses, bools.end(), 1);
+				return true;
+			}
+		default:
+			break;
+		}
+
+		auto& objects = arr.get_objects();
+		if (objects.empty())
+		{
+			return true;
+		}
+
+		double number;
+		if (get_sort_key(objects.front(), number))
+		{
+			return sort_objects<double>(objects, stable);
+		}
+		std::string_view str;
+		if (get_sort_key(objects.front(), str))
+		{
+			return sort_objects<std::string_view>(objects, stable);
+		}
+
+		LOG_ERROR("Only arrays of numbers or strings can be sorted");
+		return false;
+	}
+
+	int binary_search(ArrayObj& arr, const ObjectPtr& value)
+	{
+		double number;
+		const bool is_number = get_sort_key(value, number);
+		switch (arr.get_element_type())
+		{
+		case ElementType::Int:		return is_number ? search_values(arr.get_ints(), number) : -1;
+		case ElementType::Float:	return is_number ? search_values(arr.get_floats(), number) : -1;
+		case ElementType::Bool:
+			{
+				const auto bval = value->get_inner<bool>();
+				return bval ? search_values(arr.get_bools(), static_cast<uint8_t>(*bval)) : -1;
+			}
+		case ElementType::Generic:
+			{
+				if (is_number)
+				{
+					return search_objects(arr.get_objects(), number);
+				}
+				std::string_view str;
+				if (get_sort_key(value, str))
+				{
+					return search_objects(arr.get_objects(), str);
+				}
+				return -1;
+			}
+		default:
+			return -1;
+		}
+	}
+
+	void reverse(ArrayObj& arr)
+	{
+		switch (arr.get_element_type())
+		{
+		case ElementType::Int:		std::ranges::reverse(arr.edit_ints());		break;
+		case ElementType::Float:	std::ranges::reverse(arr.edit_floats());	break;
+		case ElementType::Bool:		std::ranges::reverse(arr.edit_bools());		break;
+		default:					std::ranges::reverse(arr.get_objects());	break;
+		}
+	}
+
+	size_t unique(ArrayObj& arr)
+	{
+		if (arr.is_fixed())
+		{
+			LOG_ERROR("Mapped arrays have a fixed size");
+			return arr.size();
+		}
+
+		switch (arr.get_element_type())
+		{
+		case ElementType::Int:		arr.truncate(unique_values(arr.edit_ints()));		break;
+		case ElementType::Float:	arr.truncate(unique_values(arr.edit_floats()));		break;
+		case ElementType::Bool:		arr.truncate(unique_values(arr.edit_bools()));		break;
+		default:
+			{
+				auto& objects = arr.get_objects();
+				objects.erase(std::unique(objects.begin(), objects.end(), same_values), objects.end());
+				break;
+			}
+		}
+		return arr.size();
+	}
+}
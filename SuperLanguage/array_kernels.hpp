@@ -0,0 +1,37 @@
+#pragma once
+
+#include <optional>
+
+#include "number.hpp"
+#include "object.hpp"
+
+// Bulk operations over whole arrays. Packed int and float arrays run
+// vectorized loops, generic arrays fall back to per element Number math.
+namespace array_kernels
+{
+	std::optional<Number> sum(ArrayObj& arr);
+
+	std::optional<Number> dot(ArrayObj& left, ArrayObj& right);
+
+	ObjectPtr min(ArrayObj& arr);
+
+	ObjectPtr max(ArrayObj& arr);
+
+	// In place: arr[i] = arr[i] * factor
+	bool scale(ArrayObj& arr, Number factor);
+
+	// In place: dst[i] = dst[i] + src[i]
+	bool add(ArrayObj& dst, ArrayObj& src);
+
+	// Ascending order. Elements must be all numbers or all strings, packed
+	// numeric arrays are radix sorted.
+	bool sort(ArrayObj& arr, bool stable);
+
+	// Index of value in a sorted array, -1 when missing
+	int binary_search(ArrayObj& arr, const ObjectPtr& value);
+
+	void reverse(ArrayObj& arr);
+
+	// Drops adjacent duplicates, returns the new size
+	size_t unique(ArrayObj& arr);
+}
@@ -0,0 +1,610 @@
+#include "builtins.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <ranges>
+#include <string>
+
+#include "array_kernels.hpp"
+#include "channel.hpp"
+#include "csv.hpp"
+#include "file.hpp"
+#include "interpreter.hpp"
+#include "log.hpp"
+#include "native.hpp"
+#include "parallel.hpp"
+#include "serialize.hpp"
+#include "stats.hpp"
+#include "string_kernels.hpp"
+#include "task.hpp"
+
+namespace
+{
+	// Strings, numbers and bools, other values are skipped
+	void write_values(Output& output, std::span<const ObjectPtr> values)
+	{
+		for (const auto& obj : values)
+		{
+			std::string_view str;
+			if (obj->get(&str))
+			{
+				output.write(str);
+				continue;
+			}
+
+			int ival;
+			if (obj->get(&ival))
+			{
+				output.write(ival);
+				continue;
+			}
+
+			float fval;
+			if (obj->get(&fval))
+			{
+				output.write(fval);
+				continue;
+			}
+
+			bool bval;
+			if (obj->get(&bval))
+			{
+				output.write(bval);
+				continue;
+			}
+		}
+	}
+
+	void init_common_functions(Program& program)
+	{
+		register_native(program, "__print", [](Interpreter* interp, std::span<const ObjectPtr> args)
+			{
+				auto& output = interp->get_output();
+				output.write(std::string_view{ "--> " });
+				write_values(output, args);
+				output.end_line();
+			});
+
+		register_native(program, "__flush", [](Interpreter* interp)
+			{
+				interp->get_output().flush();
+			});
+
+		register_native(program, "__dump_callstack", [](Interpreter* interp)
+			{
+				auto& output = interp->get_output();
+				output.write(std::string_view{ "Callstack dump:" });
+				output.end_line();
+				const auto& cs = interp->get_call_stack();
+				for (const auto func : cs | std::views::keys)
+				{
+					output.write('\t');
+					output.write(func->get_name());
+					output.end_line();
+				}
+			});
+
+		register_native(program, "__exit", [](Interpreter* interp, int res)
+			{
+				// Tasks, isolates and parallel chunks call this on pool threads, the
+				// static destructors of exit() would join the calling thread
+				interp->get_output().flush();
+				details::flush_log();
+				fflush(stdout);
+				fflush(stderr);
+				std::quick_exit(res);
+			});
+	}
+
+	// Slices and split parts share the buffer of the original string
+	void init_string_functions(Program& program)
+	{
+		register_native(program, "__str_len", [](std::string_view str)
+			{
+				return static_cast<int>(str.size());
+			});
+
+		// Optional third argument is the position to search from, -1 when not found
+		register_native(program, "__str_find", [](std::span<const ObjectPtr> args)
+			{
+				std::string_view str;
+				std::string_view needle;
+				int from = 0;
+				if ((args.size() != 2 && args.size() != 3) || !args[0]->get(&str) || !args[1]->get(&needle)
+					|| (args.size() == 3 && (!args[2]->get(&from) || from < 0)))
+				{
+					LOG_ERROR("__str_find expects a string, a string to find and an optional position");
+					return -1;
+				}
+
+				const auto pos = string_kernels::find(str, needle, static_cast<size_t>(from));
+				return pos == std::string_view::npos ? -1 : static_cast<int>(pos);
+			});
+
+		// Characters [begin, end), both clamped to the string
+		register_native(program, "__str_slice", [](String* str, int begin, int end)
+			{
+				const auto from = static_cast<size_t>(std::clamp(begin, 0, static_cast<int>(str->size())));
+				const auto to = static_cast<size_t>(std::clamp(end, 0, static_cast<int>(str->size())));
+				return str->slice(from, to > from ? to - from : 0);
+			});
+
+		register_native(program, "__str_split", [](String* str, std::string_view separator)
+			{
+				if (separator.empty())
+				{
+					LOG_ERROR("__str_split separator is empty");
+					return Ref<ArrayObj>{};
+				}
+
+				const auto view = str->get_view();
+				const auto parts = string_kernels::split(view, separator);
+				std::vector<ObjectPtr> slices;
+				slices.reserve(parts.size());
+				for (const auto part : parts)
+				{
+					slices.emplace_back(str->slice(part.data() - view.data(), part.size()));
+				}
+				return make_object<ArrayObj>(std::move(slices));
+			});
+
+		register_native(program, "__str_join", [](ArrayObj* arr, std::string_view separator)
+			{
+				std::vector<std::string_view> parts(arr->size());
+				std::vector<ObjectPtr> elements(arr->size());
+				size_t total = 0;
+				for (size_t i = 0; i < parts.size(); ++i)
+				{
+					elements[i] = arr->get_element(i);
+					if (!elements[i]->get(&parts[i]))
+					{
+						LOG_ERROR("__str_join array element {} is not a string", i);
+						return ObjectPtr{};
+					}
+					total += parts[i].size() + separator.size();
+				}
+
+				std::string res;
+				res.reserve(total);
+				for (size_t i = 0; i < parts.size(); ++i)
+				{
+					if (i != 0)
+					{
+						res.append(separator);
+					}
+					res.append(parts[i]);
+				}
+				return ObjectPtr{ make_object<String>(std::move(res)) };
+			});
+	}
+
+	void init_array_functions(Program& program)
+	{
+		register_native(program, "__get_array_element", [](ArrayObj* arr, int index)
+			{
+				auto element = arr->get_element(index);
+				if (!element)
+				{
+					LOG_ERROR("Array index {} out of range, size {}", index, arr->size());
+				}
+				return element;
+			});
+
+		register_native(program, "__set_array_element", [](ArrayObj* arr, int index, ObjectPtr obj)
+			{
+				arr->set_element(index, std::move(obj));
+			});
+
+		register_native(program, "__get_array_size", [](ArrayObj* arr)
+			{
+				return static_cast<int>(arr->size());
+			});
+
+		register_native(program, "__array_append", [](ArrayObj* arr, ObjectPtr obj)
+			{
+				arr->append(std::move(obj));
+			});
+
+		register_native(program, "__array_new", [](int count, ObjectPtr value)
+			{
+				auto arr = make_object<ArrayObj>();
+				arr->assign(static_cast<size_t>(std::max(count, 0)), value);
+				return arr;
+			});
+
+		register_native(program, "__array_fill", [](ArrayObj* arr, ObjectPtr value)
+			{
+				arr->fill(value);
+			});
+
+		register_native(program, "__array_sum", [](ArrayObj* arr)
+			{
+				const auto res = array_kernels::sum(*arr);
+				return res ? res->as_object() : ObjectPtr{};
+			});
+
+		register_native(program, "__array_dot", [](ArrayObj* left, ArrayObj* right)
+			{
+				const auto res = array_kernels::dot(*left, *right);
+				return res ? res->as_object() : ObjectPtr{};
+			});
+
+		register_native(program, "__array_min", [](ArrayObj* arr)
+			{
+				return array_kernels::min(*arr);
+			});
+
+		register_native(program, "__array_max", [](ArrayObj* arr)
+			{
+				return array_kernels::max(*arr);
+			});
+
+		register_native(program, "__array_scale", [](ArrayObj* arr, ObjectPtr factor)
+			{
+				if (const auto k = Number::get_from_object(factor))
+				{
+					array_kernels::scale(*arr, *k);
+				}
+				else
+				{
+					LOG_ERROR("__array_scale expects a number factor");
+				}
+			});
+
+		register_native(program, "__array_add", [](ArrayObj* dst, ArrayObj* src)
+			{
+				array_kernels::add(*dst, *src);
+			});
+
+		register_native(program, "__array_sort", [](ArrayObj* arr)
+			{
+				array_kernels::sort(*arr, false);
+			});
+
+		// Keeps the order of equal elements
+		register_native(program, "__array_stable_sort", [](ArrayObj* arr)
+			{
+				array_kernels::sort(*arr, true);
+			});
+
+		register_native(program, "__array_bsearch", [](ArrayObj* arr, ObjectPtr value)
+			{
+				return array_kernels::binary_search(*arr, value);
+			});
+
+		register_native(program, "__array_reverse", [](ArrayObj* arr)
+			{
+				array_kernels::reverse(*arr);
+			});
+
+		register_native(program, "__array_unique", [](ArrayObj* arr)
+			{
+				return static_cast<int>(array_kernels::unique(*arr));
+			});
+	}
+
+	void init_map_functions(Program& program)
+	{
+		register_native(program, "__map_new", []
+			{
+				return make_object<MapObj>();
+			});
+
+		// Third argument is returned when the key is missing
+		register_native(program, "__map_get", [](std::span<const ObjectPtr> args)
+			{
+				MapObj* map;
+				if ((args.size() != 2 && args.size() != 3) || !args[0]->get(&map))
+				{
+					LOG_ERROR("__map_get expects a map, a key and an optional default value");
+					return ObjectPtr{};
+				}
+
+				if (auto value = map->find(args[1]))
+				{
+					return value;
+				}
+				if (args.size() == 3)
+				{
+					return args[2];
+				}
+
+				LOG_ERROR("Map key not found, map size {}", map->size());
+				return ObjectPtr{};
+			});
+
+		register_native(program, "__map_set", [](MapObj* map, ObjectPtr key, ObjectPtr value)
+			{
+				map->insert(std::move(key), std::move(value));
+			});
+
+		register_native(program, "__map_has", [](MapObj* map, ObjectPtr key)
+			{
+				return map->contains(key);
+			});
+
+		register_native(program, "__map_size", [](MapObj* map)
+			{
+				return static_cast<int>(map->size());
+			});
+	}
+
+	void init_file_functions(Program& program)
+	{
+		// Mode is "r" (default), "w" or "a"
+		register_native(program, "__file_open", [](std::span<const ObjectPtr> args)
+			{
+				std::string path;
+				std::string_view mode = "r";
+				if (args.empty() || args.size() > 2 || !args[0]->get(&path) || (args.size() == 2 && !args[1]->get(&mode)))
+				{
+					LOG_ERROR("__file_open expects a path and an optional mode");
+					return Ref<FileObj>{};
+				}
+
+				if (mode == "r")
+				{
+					return FileObj::open(path.c_str(), FileObj::Mode::Read);
+				}
+				if (mode == "w")
+				{
+					return FileObj::open(path.c_str(), FileObj::Mode::Write);
+				}
+				if (mode == "a")
+				{
+					return FileObj::open(path.c_str(), FileObj::Mode::Append);
+				}
+
+				LOG_ERROR("Unknown file mode {}", mode);
+				return Ref<FileObj>{};
+			});
+
+		register_native(program, "__file_close", [](FileObj* file)
+			{
+				file->close();
+			});
+
+		register_native(program, "__file_read_all", [](FileObj* file)
+			{
+				return std::string{ file->get_content() };
+			});
+
+		register_native(program, "__file_lines", [](FileObj* file)
+			{
+				return make_object<LinesIterator>(Ref<FileObj>{ file });
+			});
+
+		// Values are written like __print does, __file_write_line adds a line break
+		register_native(program, "__file_write", [](std::span<const ObjectPtr> args)
+			{
+				FileObj* file;
+				if (args.empty() || !args[0]->get(&file) || !file->get_writer())
+				{
+					LOG_ERROR("__file_write expects a file opened for writing");
+					return;
+				}
+				write_values(*file->get_writer(), args.subspan(1));
+			});
+
+		register_native(program, "__file_write_line", [](std::span<const ObjectPtr> args)
+			{
+				FileObj* file;
+				if (args.empty() || !args[0]->get(&file) || !file->get_writer())
+				{
+					LOG_ERROR("__file_write_line expects a file opened for writing");
+					return;
+				}
+				write_values(*file->get_writer(), args.subspan(1));
+				file->get_writer()->end_line();
+			});
+
+		// Array of column arrays, the first line is a header unless the second argument is false
+		register_native(program, "__csv_load", [](std::span<const ObjectPtr> args)
+			{
+				std::string path;
+				bool has_header = true;
+				if (args.empty() || args.size() > 2 || !args[0]->get(&path) || (args.size() == 2 && !args[1]->get(&has_header)))
+				{
+					LOG_ERROR("__csv_load expects a path and an optional header flag");
+					return ObjectPtr{};
+				}
+				return csv::load(path.c_str(), has_header);
+			});
+
+		// Binary value files, see serialize.hpp for the format
+		register_native(program, "__save", [](ObjectPtr value, std::string_view path)
+			{
+				return serialize::save(*value, std::string{ path }.c_str());
+			});
+
+		register_native(program, "__load", [](std::string_view path)
+			{
+				return serialize::load(std::string{ path }.c_str());
+			});
+
+		// Type is "int", "float" or "bool", count is taken from the file when missing
+		register_native(program, "__mapped_array", [](std::span<const ObjectPtr> args)
+			{
+				std::string path;
+				std::string_view type;
+				int count = 0;
+				if (args.size() < 2 || args.size() > 3 || !args[0]->get(&path) || !args[1]->get(&type) || (args.size() == 3 && !args[2]->get(&count)) || count < 0)
+				{
+					LOG_ERROR("__mapped_array expects a path, an element type and an optional count");
+					return Ref<ArrayObj>{};
+				}
+
+				if (type == "int")
+				{
+					return open_mapped_array(path.c_str(), ArrayObj::ElementType::Int, count);
+				}
+				if (type == "float")
+				{
+					return open_mapped_array(path.c_str(), ArrayObj::ElementType::Float, count);
+				}
+				if (type == "bool")
+				{
+					return open_mapped_array(path.c_str(), ArrayObj::ElementType::Bool, count);
+				}
+
+				LOG_ERROR("Unknown element type {}", type);
+				return Ref<ArrayObj>{};
+			});
+
+		// Writes the changes to the file and unmaps it, the array is left empty
+		register_native(program, "__mapped_array_close", [](ArrayObj* arr)
+			{
+				if (!arr->is_fixed())
+				{
+					LOG_ERROR("__mapped_array_close expects a mapped array");
+					return;
+				}
+				arr->clear();
+			});
+
+		register_native(program, "__iter_has_next", [](Interpreter* interp, IteratorObj* it)
+			{
+				return it->has_next(interp);
+			});
+
+		register_native(program, "__iter_next", [](Interpreter* interp, IteratorObj* it)
+			{
+				auto value = it->next(interp);
+				if (!value)
+				{
+					LOG_ERROR("Iterator is exhausted");
+				}
+				return value;
+			});
+	}
+
+	// Functions are passed by name
+	Function* find_script_function(Interpreter* interp, std::string_view name)
+	{
+		const auto func = interp->find_function(name);
+		if (!func)
+		{
+			LOG_ERROR("Function {} not found", name);
+		}
+		return func;
+	}
+
+	void init_parallel_functions(Program& program)
+	{
+		register_native(program, "__parallel_map", [](Interpreter* interp, ArrayObj* arr, std::string_view name)
+			{
+				const auto func = find_script_function(interp, name);
+				return func ? parallel::map(interp, *arr, func) : ObjectPtr{};
+			});
+
+		register_native(program, "__parallel_reduce", [](Interpreter* interp, ArrayObj* arr, std::string_view name, ObjectPtr init)
+			{
+				const auto func = find_script_function(interp, name);
+				return func ? parallel::reduce(interp, *arr, func, std::move(init)) : ObjectPtr{};
+			});
+
+		// Result of a spawned task, waits for it when still running
+		register_native(program, "__await", [](TaskObj* task)
+			{
+				return task->await();
+			});
+
+		register_native(program, "__task_done", [](TaskObj* task)
+			{
+				return task->is_done();
+			});
+
+		register_native(program, "__chan_new", [](int capacity)
+			{
+				// Used from several threads, keep it off the collector heap
+				Heap::Guard heap_guard{ nullptr };
+				auto channel = make_object<ChannelObj>(static_cast<size_t>(std::max(capacity, 1)));
+				channel->mark_shared();
+				return channel;
+			});
+
+		register_native(program, "__chan_send", [](ChannelObj* channel, ObjectPtr value)
+			{
+				return channel->send(std::move(value));
+			});
+
+		// Null once the channel is closed and every sent value was received
+		register_native(program, "__chan_recv", [](ChannelObj* channel)
+			{
+				return channel->receive();
+			});
+
+		register_native(program, "__chan_close", [](ChannelObj* channel)
+			{
+				channel->close();
+			});
+	}
+
+	void init_memory_functions(Program& program)
+	{
+		register_native(program, "__gc_collect", [](Interpreter* interp)
+			{
+				ObjectPtr freed;
+				if (Heap* heap = interp->get_heap())
+				{
+					heap->collect();
+					freed = Integer::make(static_cast<int>(heap->get_stats().freed_objects));
+				}
+				return freed;
+			});
+
+		// [Integer, Float, Bool, String] pool allocations followed by small integer cache hits
+		register_native(program, "__alloc_stats", []
+			{
+				const auto stats = get_allocation_stats();
+				const std::vector<ObjectPtr> values = {
+					Integer::make(static_cast<int>(stats.integers.allocations)),
+					Integer::make(static_cast<int>(stats.floats.allocations)),
+					Integer::make(static_cast<int>(stats.bools.allocations)),
+					Integer::make(static_cast<int>(stats.strings.allocations)),
+					Integer::make(static_cast<int>(stats.cached_integers))
+				};
+				return make_object<ArrayObj>(values);
+			});
+
+		// [name, count] pairs of the --stats counters, nodes first, then allocations
+		// and the stack high water marks. Empty unless the run counts.
+		register_native(program, "__stats", []
+			{
+				std::vector<ObjectPtr> values;
+				if (!stats::enabled)
+				{
+					return make_object<ArrayObj>(values);
+				}
+
+				const auto report = stats::collect();
+				auto add_entry = [&values](const std::string& name, uint64_t count)
+					{
+						const std::vector<ObjectPtr> entry = { make_object<String>(std::string{ name }), Integer::make(static_cast<int>(count)) };
+						values.push_back(make_object<ArrayObj>(entry));
+					};
+				for (const auto& entry : report.nodes)
+				{
+					add_entry(entry.name, entry.count);
+				}
+				for (const auto& entry : report.allocations)
+				{
+					add_entry("new " + entry.name, entry.count);
+				}
+				add_entry("max stack size", report.max_stack_size);
+				add_entry("max call depth", report.max_call_depth);
+				return make_object<ArrayObj>(values);
+			});
+	}
+}
+
+void init_internal_functions(Program& program)
+{
+	init_common_functions(program);
+	init_string_functions(program);
+	init_array_functions(program);
+	init_map_functions(program);
+	init_file_functions(program);
+	init_parallel_functions(program);
+	init_memory_functions(program);
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+class Program;
+
+void init_internal_functions(Program& program);
@@ -0,0 +1,189 @@
+#include "channel.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <thread>
+
+#include "log.hpp"
+#include "scheduler.hpp"
+
+namespace
+{
+	// Attempts before a blocked sender or receiver parks, the other side
+	// is often just about to make room
+	constexpr int spin_count = 16;
+}
+
+ChannelObj::ChannelObj(size_t capacity)
+	:_cells(std::make_unique<Cell[]>(std::bit_ceil(std::max<size_t>(capacity, 2))))
+	,_mask(std::bit_ceil(std::max<size_t>(capacity, 2)) - 1)
+{
+	for (size_t i = 0; i <= _mask; ++i)
+	{
+		_cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+}
+
+bool ChannelObj::send(ObjectPtr value)
+{
+	if (is_closed())
+	{
+		LOG_ERROR("Failed to send, channel is closed");
+		return false;
+	}
+
+	// Received on another thread
+	value->mark_shared();
+	for (int spin = 0; spin < spin_count; ++spin)
+	{
+		if (try_push(value))
+		{
+			wake(_receive_waiters, _not_empty);
+			return true;
+		}
+		std::this_thread::yield();
+	}
+
+	{
+		Scheduler::BlockingGuard blocking_guard{ [this] { wake_all(); } };
+		std::unique_lock lock{ _mutex };
+		_send_waiters.fetch_add(1);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		_not_full.wait(lock, [&] { return try_push(value) || is_closed() || blocking_guard.is_stopping(); });
+		_send_waiters.fetch_sub(1);
+		if (value && !is_closed())
+		{
+			// Process exits, nobody is left to receive
+			return false;
+		}
+	}
+
+	// Pushed values are moved out
+	if (value)
+	{
+		LOG_ERROR("Failed to send, channel is closed");
+		return false;
+	}
+	wake(_receive_waiters, _not_empty);
+	return true;
+}
+
+ObjectPtr ChannelObj::receive()
+{
+	ObjectPtr value;
+	for (int spin = 0; spin < spin_count; ++spin)
+	{
+		if (try_pop(value))
+		{
+			wake(_send_waiters, _not_full);
+			return value;
+		}
+		if (is_closed())
+		{
+			break;
+		}
+		std::this_thread::yield();
+	}
+
+	{
+		// Gives up with no value when the process exits
+		Scheduler::BlockingGuard blocking_guard{ [this] { wake_all(); } };
+		std::unique_lock lock{ _mutex };
+		_receive_waiters.fetch_add(1);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		_not_empty.wait(lock, [&] { return try_pop(value) || is_closed() || blocking_guard.is_stopping(); });
+		_receive_waiters.fetch_sub(1);
+	}
+
+	if (value)
+	{
+		wake(_send_waiters, _not_full);
+	}
+	return value;
+}
+
+void ChannelObj::close()
+{
+	_closed.store(true, std::memory_order_release);
+	wake_all();
+}
+
+void ChannelObj::wake_all()
+{
+	{
+		// Waiters are either asleep or about to see the flag
+		std::lock_guard lock{ _mutex };
+	}
+	_not_full.notify_all();
+	_not_empty.notify_all();
+}
+
+bool ChannelObj::try_push(ObjectPtr& value)
+{
+	auto pos = _enqueue_pos.load(std::memory_order_relaxed);
+	while (true)
+	{
+		Cell& cell = _cells[pos & _mask];
+		const auto sequence = cell.sequence.load(std::memory_order_acquire);
+		const auto diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+		if (diff == 0)
+		{
+			if (_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+			{
+				cell.value = std::move(value);
+				cell.sequence.store(pos + 1, std::memory_order_release);
+				return true;
+			}
+		}
+		else if (diff < 0)
+		{
+			// Cell still holds the value from one lap ago
+			return false;
+		}
+		else
+		{
+			pos = _enqueue_pos.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+bool ChannelObj::try_pop(ObjectPtr& value)
+{
+	auto pos = _dequeue_pos.load(std::memory_order_relaxed);
+	while (true)
+	{
+		Cell& cell = _cells[pos & _mask];
+		const auto sequence = cell.sequence.load(std::memory_order_acquire);
+		const auto diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+		if (diff == 0)
+		{
+			if (_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+			{
+				value = std::move(cell.value);
+				cell.sequence.store(pos + _mask + 1, std::memory_order_release);
+				return true;
+			}
+		}
+		else if (diff < 0)
+		{
+			// Nothing written to the cell yet
+			return false;
+		}
+		else
+		{
+			pos = _dequeue_pos.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+void ChannelObj::wake(std::atomic<size_t>& waiters, std::condition_variable& cv)
+{
+	// Pairs with the fence of the waiter, either it sees the change or we see it waiting
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (waiters.load(std::memory_order_relaxed) != 0)
+	{
+		std::lock_guard lock{ _mutex };
+		cv.notify_one();
+	}
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+
+#include "object.hpp"
+
+// Bounded multi-producer multi-consumer queue between tasks. Values are
+// moved through a lock-free ring of cells, each with a sequence number
+// telling producers and consumers whose turn the cell is. Only a send to
+// a full channel or a receive from an empty one takes the mutex.
+//
+// Tasks have no stack of their own, so a blocked send or receive parks
+// the calling thread and a spare scheduler thread takes over its queue.
+// Helping the scheduler instead could nest the waiting thread under the
+// very task it waits for.
+class ChannelObj final : public Object
+{
+public:
+	// Capacity is rounded up to a power of two
+	explicit ChannelObj(size_t capacity);
+
+	bool get(ChannelObj** val) override { (*val) = this; return true; }
+
+	// Waits while the channel is full, false once it is closed
+	bool send(ObjectPtr value);
+
+	// Waits while the channel is empty, null once it is closed and drained
+	ObjectPtr receive();
+
+	// Wakes every waiting sender and receiver, queued values can still be received
+	void close();
+
+	bool is_closed() const { return _closed.load(std::memory_order_acquire); }
+
+private:
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		ObjectPtr value;
+	};
+
+	bool try_push(ObjectPtr& value);
+
+	bool try_pop(ObjectPtr& value);
+
+	void wake(std::atomic<size_t>& waiters, std::condition_variable& cv);
+
+	void wake_all();
+
+	std::unique_ptr<Cell[]> _cells;
+	size_t _mask;
+	// Producers and consumers touch different lines
+	alignas(64) std::atomic<size_t> _enqueue_pos = 0;
+	alignas(64) std::atomic<size_t> _dequeue_pos = 0;
+	alignas(64) std::atomic<bool> _closed = false;
+	std::atomic<size_t> _send_waiters = 0;
+	std::atomic<size_t> _receive_waiters = 0;
+	std::mutex _mutex;
+	std::condition_variable _not_full;
+	std::condition_variable _not_empty;
+};
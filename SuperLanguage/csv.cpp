@@ -0,0 +1,401 @@
+#include "csv.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "gc.hpp"
+#include "log.hpp"
+#include "mapped_file.hpp"
+#include "simd.hpp"
+#include "thread_pool.hpp"
+
+namespace
+{
+	// Smaller chunks are not worth a thread
+	constexpr size_t min_chunk_size = 1024 * 1024;
+	// Extra chunks even out lines of different length
+	constexpr size_t chunks_per_thread = 4;
+
+	// Ordered from the narrowest type, a column takes the widest type of its fields
+	enum class ColumnType : uint8_t
+	{
+		Empty,
+		Int,
+		Float,
+		String
+	};
+
+	// Finds delimiters, line breaks and quotes 16 bytes at a time
+	class Scanner
+	{
+	public:
+		Scanner(const char* end, char delimiter)
+			:_end(end)
+			,_delimiter(delimiter)
+		{}
+
+		void seek(const char* pos)
+		{
+			_block = pos;
+			_mask = _block < _end ? load_mask(_block) : 0;
+		}
+
+		// Next delimiter or line break, quotes inside unquoted fields are skipped
+		const char* next_separator()
+		{
+			const char* pos;
+			do
+			{
+				pos = next();
+			} while (pos < _end && *pos == '"');
+			return pos;
+		}
+
+	private:
+		const char* next()
+		{
+			while (_mask == 0)
+			{
+				_block += 16;
+				if (_block >= _end)
+				{
+					return _end;
+				}
+				_mask = load_mask(_block);
+			}
+
+			const auto offset = std::countr_zero(_mask);
+			_mask &= _mask - 1;
+			return _block + offset;
+		}
+
+		uint32_t load_mask(const char* block) const
+		{
+#if HAS_SSE2
+			if (_end - block >= 16)
+			{
+				const __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block));
+				const __m128i hits = _mm_or_si128(
+					_mm_or_si128(_mm_cmpeq_epi8(data, _mm_set1_epi8(_delimiter)), _mm_cmpeq_epi8(data, _mm_set1_epi8('\n'))),
+					_mm_cmpeq_epi8(data, _mm_set1_epi8('"')));
+				return static_cast<uint32_t>(_mm_movemask_epi8(hits));
+			}
+#endif
+			uint32_t mask = 0;
+			const auto count = std::min<ptrdiff_t>(16, _end - block);
+			for (ptrdiff_t i = 0; i < count; ++i)
+			{
+				const char ch = block[i];
+				if (ch == _delimiter || ch == '\n' || ch == '"')
+				{
+					mask |= 1u << i;
+				}
+			}
+			return mask;
+		}
+
+		const char* _end;
+		const char* _block = nullptr;
+		uint32_t _mask = 0;
+		char _delimiter;
+	};
+
+	// Calls on_field(row, column, field, escaped) for the first columns of
+	// every non blank line and returns the row count. Escaped fields still
+	// contain doubled quotes.
+	template <class F>
+	size_t parse_rows(const char* begin, const char* end, char delimiter, size_t columns, F&& on_field)
+	{
+		Scanner scanner{ end, delimiter };
+		size_t row = 0;
+		const char* pos = begin;
+		while (pos < end)
+		{
+			if (*pos == '\n' || (*pos == '\r' && pos + 1 < end && pos[1] == '\n'))
+			{
+				pos += *pos == '\r' ? 2 : 1;
+				continue;
+			}
+
+			scanner.seek(pos);
+			size_t column = 0;
+			while (true)
+			{
+				std::string_view field;
+				bool quoted = false;
+				bool escaped = false;
+				const char* stop;
+				if (pos < end && *pos == '"')
+				{
+					quoted = true;
+					const char* close = pos + 1;
+					while (true)
+					{
+						close = static_cast<const char*>(std::memchr(close, '"', end - close));
+						if (!close)
+						{
+							close = end;
+							break;
+						}
+						if (close + 1 < end && close[1] == '"')
+						{
+							escaped = true;
+							close += 2;
+							continue;
+						}
+						break;
+					}
+					field = { pos + 1, static_cast<size_t>(close - pos - 1) };
+					scanner.seek(std::min(close + 1, end));
+					stop = scanner.next_separator();
+				}
+				else
+				{
+					stop = scanner.next_separator();
+					field = { pos, static_cast<size_t>(stop - pos) };
+				}
+
+				const bool line_end = stop >= end || *stop == '\n';
+				if (line_end && !quoted && !field.empty() && field.back() == '\r')
+				{
+					field.remove_suffix(1);
+				}
+				if (column < columns)
+				{
+					on_field(row, column, field, escaped);
+				}
+				++column;
+
+				if (line_end)
+				{
+					pos = std::min(stop + 1, end);
+					break;
+				}
+
+				pos = stop + 1;
+				if (pos >= end)
+				{
+					// Delimiter right before the end of file, last field is empty
+					if (column < columns)
+					{
+						on_field(row, column, std::string_view{}, false);
+					}
+					break;
+				}
+			}
+			++row;
+		}
+		return row;
+	}
+
+	ColumnType classify(std::string_view field, ColumnType current)
+	{
+		if (field.empty())
+		{
+			return ColumnType::Empty;
+		}
+
+		const char* end = field.data() + field.size();
+		if (current <= ColumnType::Int)
+		{
+			int ival;
+			const auto res = std::from_chars(field.data(), end, ival);
+			if (res.ec == std::errc{} && res.ptr == end)
+			{
+				return ColumnType::Int;
+			}
+		}
+		if (current <= ColumnType::Float)
+		{
+			float fval;
+			const auto res = std::from_chars(field.data(), end, fval);
+			if (res.ec == std::errc{} && res.ptr == end)
+			{
+				return ColumnType::Float;
+			}
+		}
+		return ColumnType::String;
+	}
+
+	std::string unescape(std::string_view field)
+	{
+		std::string res;
+		res.reserve(field.size());
+		for (size_t i = 0; i < field.size(); ++i)
+		{
+			res.push_back(field[i]);
+			if (field[i] == '"' && i + 1 < field.size() && field[i + 1] == '"')
+			{
+				++i;
+			}
+		}
+		return res;
+	}
+
+	struct Column
+	{
+		ColumnType type = ColumnType::Empty;
+		std::vector<int> ints;
+		std::vector<float> floats;
+		std::vector<ObjectPtr> strings;
+	};
+
+	// Splits [begin, end) into pieces starting at line beginnings
+	std::vector<const char*> split_chunks(const char* begin, const char* end, size_t count)
+	{
+		std::vector<const char*> bounds{ begin };
+		const auto size = static_cast<size_t>(end - begin);
+		for (size_t i = 1; i < count; ++i)
+		{
+			const char* pos = std::max(begin + size * i / count, bounds.back());
+			const auto line_end = static_cast<const char*>(std::memchr(pos, '\n', end - pos));
+			bounds.push_back(line_end ? line_end + 1 : end);
+		}
+		bounds.push_back(end);
+		return bounds;
+	}
+}
+
+namespace csv
+{
+	ObjectPtr load(const char* path, bool has_header, char delimiter)
+	{
+		MappedFile file;
+		if (!file.open(path))
+		{
+			return {};
+		}
+
+		const auto content = file.get_content();
+		if (content.empty())
+		{
+			return make_object<ArrayObj>();
+		}
+
+		const char* begin = content.data();
+		const char* end = begin + content.size();
+
+		// Width of the table is set by the first line
+		const auto first_end = static_cast<const char*>(std::memchr(begin, '\n', content.size()));
+		const char* data_begin = first_end ? first_end + 1 : end;
+		size_t columns = 0;
+		parse_rows(begin, data_begin, delimiter, SIZE_MAX, [&](size_t, size_t column, std::string_view, bool)
+			{
+				columns = column + 1;
+			});
+		if (!has_header)
+		{
+			data_begin = begin;
+		}
+
+		auto& pool = ThreadPool::get_default();
+		const auto chunk_count = std::clamp(static_cast<size_t>(end - data_begin) / min_chunk_size, size_t{ 1 }, pool.get_concurrency() * chunks_per_thread);
+		const auto bounds = split_chunks(data_begin, end, chunk_count);
+
+		// First pass finds the column types and the rows of every chunk
+		std::vector<std::vector<ColumnType>> chunk_types(chunk_count, std::vector<ColumnType>(columns));
+		std::vector<size_t> chunk_rows(chunk_count + 1);
+		pool.run(chunk_count, [&](size_t chunk)
+			{
+				auto& types = chunk_types[chunk];
+				chunk_rows[chunk + 1] = parse_rows(bounds[chunk], bounds[chunk + 1], delimiter, columns, [&](size_t, size_t column, std::string_view field, bool escaped)
+					{
+						auto& type = types[column];
+						if (type != ColumnType::String)
+						{
+							type = escaped ? ColumnType::String : std::max(type, classify(field, type));
+						}
+					});
+			});
+
+		for (size_t i = 1; i <= chunk_count; ++i)
+		{
+			chunk_rows[i] += chunk_rows[i - 1];
+		}
+		const auto rows = chunk_rows.back();
+
+		std::vector<Column> table(columns);
+		for (size_t c = 0; c < columns; ++c)
+		{
+			auto& column = table[c];
+			for (const auto& types : chunk_types)
+			{
+				column.type = std::max(column.type, types[c]);
+			}
+
+			switch (column.type)
+			{
+			case ColumnType::Empty:
+			case ColumnType::Int:		column.ints.resize(rows);		break;
+			case ColumnType::Float:		column.floats.resize(rows);		break;
+			case ColumnType::String:	column.strings.resize(rows);	break;
+			}
+		}
+
+		// Second pass stores the values, every chunk owns its rows
+		pool.run(chunk_count, [&](size_t chunk)
+			{
+				// String cells are refcounted whichever thread parses the chunk,
+				// on the calling thread they would land on its script heap, which
+				// knows nothing of the table being filled
+				Heap::Guard heap_guard{ nullptr };
+				const auto first_row = chunk_rows[chunk];
+				parse_rows(bounds[chunk], bounds[chunk + 1], delimiter, columns, [&](size_t row, size_t c, std::string_view field, bool escaped)
+					{
+						auto& column = table[c];
+						const auto index = first_row + row;
+						const char* field_end = field.data() + field.size();
+						switch (column.type)
+						{
+						case ColumnType::Empty:
+						case ColumnType::Int:
+							std::from_chars(field.data(), field_end, column.ints[index]);
+							break;
+						case ColumnType::Float:
+							std::from_chars(field.data(), field_end, column.floats[index]);
+							break;
+						case ColumnType::String:
+							column.strings[index] = make_object<String>(escaped ? unescape(field) : std::string{ field });
+							break;
+						}
+					});
+			});
+
+		std::vector<ObjectPtr> arrays;
+		arrays.reserve(columns);
+		for (auto& column : table)
+		{
+			auto arr = make_object<ArrayObj>();
+			switch (column.type)
+			{
+			case ColumnType::Empty:
+			case ColumnType::Int:
+				arr->assign(std::move(column.ints));
+				break;
+			case ColumnType::Float:
+				arr->assign(std::move(column.floats));
+				break;
+			case ColumnType::String:
+				{
+					// Rows shorter than the first line miss trailing fields
+					const ObjectPtr empty = make_object<String>(std::string{});
+					for (auto& str : column.strings)
+					{
+						if (!str)
+						{
+							str = empty;
+						}
+					}
+					arr = make_object<ArrayObj>(std::move(column.strings));
+				}
+				break;
+			}
+			arrays.emplace_back(std::move(arr));
+		}
+		return make_object<ArrayObj>(std::move(arrays));
+	}
+}
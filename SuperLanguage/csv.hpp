@@ -0,0 +1,14 @@
+#pragma once
+
+#include "object.hpp"
+
+// Columnar CSV loading. The file is mapped and parsed in parallel chunks,
+// each column becomes one array: packed ints or floats when every field of
+// the column parses as such, strings otherwise. Empty fields of numeric
+// columns are 0. Quoted fields may contain delimiters and doubled quotes
+// but no line breaks.
+namespace csv
+{
+	// Array of column arrays, null when the file can't be read
+	ObjectPtr load(const char* path, bool has_header, char delimiter = ',');
+}
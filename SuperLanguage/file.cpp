@@ -0,0 +1,133 @@
+#include "file.hpp"
+
+#include <string>
+
+#include "log.hpp"
+
+Ref<FileObj> FileObj::open(const char* path, Mode mode)
+{
+	auto file = make_object<FileObj>(mode);
+	if (mode == Mode::Read)
+	{
+		if (!file->_mapping.open(path))
+		{
+			return {};
+		}
+		return file;
+	}
+
+	const auto status = fopen_s(&file->_stream, path, mode == Mode::Write ? "wb" : "ab");
+	if (status != 0)
+	{
+		char buff[256];
+		if (strerror_s(buff, sizeof buff, status) == 0)
+		{
+			LOG_ERROR("Failed to open {}: {}", path, buff);
+		}
+		return {};
+	}
+	file->_writer = std::make_unique<Output>(file->_stream);
+	return file;
+}
+
+FileObj::FileObj(Mode mode)
+	:_mode(mode)
+{}
+
+FileObj::~FileObj()
+{
+	close();
+}
+
+bool FileObj::is_open() const
+{
+	return _mapping.is_open() || _stream;
+}
+
+void FileObj::close()
+{
+	// Writer flushes into the stream on destruction
+	_writer.reset();
+	if (_stream)
+	{
+		fclose(_stream);
+		_stream = nullptr;
+	}
+	_mapping.close();
+}
+
+std::string_view FileObj::get_content() const
+{
+	return _mapping.get_content();
+}
+
+Ref<ArrayObj> open_mapped_array(const char* path, ArrayObj::ElementType type, size_t count)
+{
+	size_t element_size;
+	switch (type)
+	{
+	case ArrayObj::ElementType::Int:	element_size = sizeof(int);		break;
+	case ArrayObj::ElementType::Float:	element_size = sizeof(float);	break;
+	case ArrayObj::ElementType::Bool:	element_size = sizeof(uint8_t);	break;
+	default:
+		LOG_ERROR("Mapped arrays hold ints, floats or bools");
+		return {};
+	}
+
+	auto file = std::make_shared<MappedFile>();
+	if (!file->open_writable(path, count * element_size))
+	{
+		return {};
+	}
+	if (count == 0)
+	{
+		count = file->get_content().size() / element_size;
+	}
+
+	auto arr = make_object<ArrayObj>();
+	if (count != 0)
+	{
+		char* data = file->get_writable_data();
+		arr->assign_external(type, std::move(file), data, count, true);
+	}
+	return arr;
+}
+
+LinesIterator::LinesIterator(Ref<FileObj> file)
+	:_file(std::move(file))
+{}
+
+bool LinesIterator::has_next(Interpreter*)
+{
+	return _file && _offset < _file->get_content().size();
+}
+
+ObjectPtr LinesIterator::next(Interpreter* interp)
+{
+	if (!has_next(interp))
+	{
+		return {};
+	}
+
+	// Mapping is looked up on every call, the file may have been closed
+	const auto rest = _file->get_content().substr(_offset);
+	const auto end = rest.find('\n');
+	auto line = rest.substr(0, end);
+	_offset += end == std::string_view::npos ? rest.size() : end + 1;
+
+	if (!line.empty() && line.back() == '\r')
+	{
+		line.remove_suffix(1);
+	}
+	return make_object<String>(std::string{ line });
+}
+
+void LinesIterator::trace(Tracer& tracer)
+{
+	tracer.visit(_file.get());
+}
+
+void LinesIterator::clear_references()
+{
+	_file.reset();
+}
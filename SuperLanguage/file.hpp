@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdio>
+#include <memory>
+#include <string_view>
+
+#include "mapped_file.hpp"
+#include "object.hpp"
+#include "output.hpp"
+
+// Script file handle. Files opened for reading are memory mapped, files
+// opened for writing go through an Output buffer.
+class FileObj : public Object
+{
+public:
+	enum class Mode
+	{
+		Read,
+		Write,
+		Append
+	};
+
+	// Null when the file can't be opened, the reason is logged
+	static Ref<FileObj> open(const char* path, Mode mode);
+
+	explicit FileObj(Mode mode);
+
+	~FileObj() override;
+
+	bool get(FileObj** val) override { (*val) = this; return true; }
+
+	Mode get_mode() const { return _mode; }
+
+	bool is_open() const;
+
+	void close();
+
+	// Mapped content, empty for closed files and files opened for writing
+	std::string_view get_content() const;
+
+	// Null for closed files and files opened for reading
+	Output* get_writer() { return _writer.get(); }
+
+private:
+	Mode _mode;
+	MappedFile _mapping;
+	FILE* _stream = nullptr;
+	std::unique_ptr<Output> _writer;
+};
+
+// Array of fixed width elements stored in a file, ints and floats as 32
+// bit values and bools as bytes. The file is mapped for writing, pages are
+// loaded and written back by the OS, so the array may exceed the memory.
+// A count of 0 takes the count from the file size, a larger count extends
+// the file with zeros. Changes reach the file at the latest when the array
+// is cleared or destroyed. Null when the file can't be mapped.
+Ref<ArrayObj> open_mapped_array(const char* path, ArrayObj::ElementType type, size_t count);
+
+// Lines of a mapped file without the line breaks. Only the current line is
+// copied out of the mapping.
+class LinesIterator final : public IteratorObj
+{
+public:
+	explicit LinesIterator(Ref<FileObj> file);
+
+	bool has_next(Interpreter* interp) override;
+
+	ObjectPtr next(Interpreter* interp) override;
+
+	void trace(Tracer& tracer) override;
+
+	void clear_references() override;
+
+private:
+	Ref<FileObj> _file;
+	size_t _offset = 0;
+};
@@ -0,0 +1,27 @@
+#include "fuel.hpp"
+
+#include <algorithm>
+#include <limits>
+
+namespace
+{
+	// Step of runs without slices, large enough to keep workers off the tank
+	constexpr int64_t default_step = 4096;
+}
+
+FuelTank::FuelTank(const FuelLimits& limits)
+	:_limits(limits)
+	,_step(limits.slice > 0 ? limits.slice : default_step)
+	,_remaining(limits.budget > 0 ? limits.budget : std::numeric_limits<int64_t>::max())
+{
+}
+
+int64_t FuelTank::take()
+{
+	const auto remaining = _remaining.fetch_sub(_step, std::memory_order_relaxed);
+	if (remaining <= 0)
+	{
+		return 0;
+	}
+	return std::min(remaining, _step);
+}
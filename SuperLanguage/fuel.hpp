@@ -0,0 +1,40 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Work limits of a script run in fuel units. A unit is spent on every loop
+// iteration and every function call, so any computation that doesn't end
+// keeps spending.
+struct FuelLimits
+{
+	// Units the whole run may spend, 0 for no limit
+	int64_t budget = 0;
+	// Units after which the running thread lets other threads run, 0 to never yield
+	int64_t slice = 0;
+};
+
+// Budget of one run, shared by its interpreter and the workers started
+// from it. Interpreters take fuel in steps of a slice and count it down
+// on their own, the tank is only touched once per step.
+class FuelTank
+{
+public:
+	explicit FuelTank(const FuelLimits& limits);
+
+	// Fuel for the next step, 0 once the budget is spent
+	int64_t take();
+
+	bool is_empty() const { return _remaining.load(std::memory_order_relaxed) <= 0; }
+
+	// True for the first caller only, the error is reported once per run
+	bool report_empty() { return !_reported.exchange(true, std::memory_order_relaxed); }
+
+	const FuelLimits& get_limits() const { return _limits; }
+
+private:
+	FuelLimits _limits;
+	int64_t _step;
+	std::atomic<int64_t> _remaining;
+	std::atomic<bool> _reported = false;
+};
@@ -0,0 +1,278 @@
+#include "gc.hpp"
+
+#include <cassert>
+#include <format>
+
+#include "log.hpp"
+
+namespace gc
+{
+	thread_local Heap* current_heap = nullptr;
+
+	void* allocate(Heap* heap, size_t size)
+	{
+		return heap->allocate(size);
+	}
+
+	void track(Heap* heap, Object* obj)
+	{
+		heap->track(obj);
+	}
+}
+
+namespace
+{
+	class MarkTracer final : public Tracer
+	{
+	public:
+		MarkTracer(std::vector<Object*>& worklist)
+			:_worklist(worklist)
+		{}
+
+		void visit(Object* obj) override
+		{
+			if (obj && obj->is_managed())
+			{
+				_worklist.push_back(obj);
+			}
+		}
+
+	private:
+		std::vector<Object*>& _worklist;
+	};
+}
+
+Heap::Heap() = default;
+
+Heap::~Heap()
+{
+	destroy_all();
+}
+
+Heap* Heap::get_current()
+{
+	return gc::current_heap;
+}
+
+void* Heap::allocate(size_t size)
+{
+	if (_objects.size() >= _threshold && !_collecting)
+	{
+		collect();
+	}
+
+	const size_t slot_size = sizeof(Header) + size;
+	std::byte* mem = nullptr;
+	if (slot_size <= max_small_size)
+	{
+		auto& size_class = _classes[get_class_index(slot_size)];
+		if (!size_class.free_list)
+		{
+			add_page(size_class, (get_class_index(slot_size) + 1) * size_step);
+		}
+
+		FreeSlot* slot = size_class.free_list;
+		size_class.free_list = slot->next;
+		mem = reinterpret_cast<std::byte*>(slot);
+	}
+	else
+	{
+		mem = static_cast<std::byte*>(::operator new(slot_size, std::align_val_t{ alignof(Header) }));
+	}
+
+	auto* header = new (mem) Header{ size, 0 };
+	return header + 1;
+}
+
+void Heap::track(Object* obj)
+{
+	obj->_managed = true;
+	_objects.push_back(obj);
+
+	++_stats.live_objects;
+	_stats.live_bytes += get_header(obj)->size;
+}
+
+void Heap::collect()
+{
+	constexpr int64_t reachable = -1;
+
+	_collecting = true;
+	const auto start = std::chrono::steady_clock::now();
+
+	// Every reference not coming from another heap object is external,
+	// objects left with a positive count after subtracting the internal
+	// ones are the roots.
+	for (Object* obj : _objects)
+	{
+		get_header(obj)->gc_refs = obj->get_ref_count();
+	}
+
+	// Workers may be changing the children of shared objects, those are
+	// not traced. Their children are shared too and keep the reference
+	// from the parent in the count, which makes them roots.
+	std::vector<Object*> children;
+	MarkTracer tracer{ children };
+	for (Object* obj : _objects)
+	{
+		if (obj->is_shared())
+		{
+			continue;
+		}
+		obj->trace(tracer);
+		for (Object* child : children)
+		{
+			--get_header(child)->gc_refs;
+		}
+		children.clear();
+	}
+
+	std::vector<Object*> worklist;
+	for (Object* obj : _objects)
+	{
+		auto* header = get_header(obj);
+		if (header->gc_refs > 0)
+		{
+			header->gc_refs = reachable;
+			worklist.push_back(obj);
+		}
+	}
+
+	MarkTracer mark_tracer{ worklist };
+	while (!worklist.empty())
+	{
+		Object* obj = worklist.back();
+		worklist.pop_back();
+		if (obj->is_shared())
+		{
+			continue;
+		}
+
+		const auto first_child = worklist.size();
+		obj->trace(mark_tracer);
+		for (auto i = first_child; i < worklist.size();)
+		{
+			auto* header = get_header(worklist[i]);
+			if (header->gc_refs == reachable)
+			{
+				worklist[i] = worklist.back();
+				worklist.pop_back();
+				continue;
+			}
+			header->gc_refs = reachable;
+			++i;
+		}
+	}
+
+	std::vector<Object*> garbage;
+	std::erase_if(_objects, [&garbage](Object* obj)
+		{
+			if (get_header(obj)->gc_refs != reachable)
+			{
+				garbage.push_back(obj);
+				return true;
+			}
+			return false;
+		});
+
+	for (Object* obj : garbage)
+	{
+		obj->clear_references();
+	}
+
+	_stats.freed_objects = garbage.size();
+	_stats.freed_bytes = 0;
+	for (Object* obj : garbage)
+	{
+		_stats.freed_bytes += get_header(obj)->size;
+		free_object(obj);
+	}
+
+	_stats.live_objects = _objects.size();
+	_stats.live_bytes -= _stats.freed_bytes;
+	_stats.pause = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+	++_stats.collections;
+
+	_threshold = std::max(min_threshold, _objects.size() * 2);
+	_collecting = false;
+
+	if (_report)
+	{
+		report();
+	}
+}
+
+Heap::Header* Heap::get_header(const Object* obj)
+{
+	return reinterpret_cast<Header*>(const_cast<Object*>(obj)) - 1;
+}
+
+size_t Heap::get_class_index(size_t size)
+{
+	return (size + size_step - 1) / size_step - 1;
+}
+
+void Heap::add_page(SizeClass& size_class, size_t slot_size)
+{
+	auto page = std::make_unique<std::byte[]>(page_size);
+	for (size_t offset = 0; offset + slot_size <= page_size; offset += slot_size)
+	{
+		auto* slot = reinterpret_cast<FreeSlot*>(page.get() + offset);
+		slot->next = size_class.free_list;
+		size_class.free_list = slot;
+	}
+	size_class.pages.push_back(std::move(page));
+	++_stats.pages;
+}
+
+void Heap::free_object(Object* obj)
+{
+	auto* header = get_header(obj);
+	const size_t slot_size = sizeof(Header) + header->size;
+	obj->~Object();
+	header->~Header();
+
+	if (slot_size <= max_small_size)
+	{
+		auto& size_class = _classes[get_class_index(slot_size)];
+		auto* slot = reinterpret_cast<FreeSlot*>(header);
+		slot->next = size_class.free_list;
+		size_class.free_list = slot;
+	}
+	else
+	{
+		::operator delete(header, std::align_val_t{ alignof(Header) });
+	}
+}
+
+void Heap::destroy_all()
+{
+	for (Object* obj : _objects)
+	{
+		obj->clear_references();
+	}
+	for (Object* obj : _objects)
+	{
+		free_object(obj);
+	}
+	_objects.clear();
+}
+
+void Heap::report() const
+{
+	const auto msg = std::format("[gc] #{}: freed {} objects ({} KB), live {} objects ({} KB) in {} pages, pause {} us",
+		_stats.collections, _stats.freed_objects, _stats.freed_bytes / 1024,
+		_stats.live_objects, _stats.live_bytes / 1024, _stats.pages, _stats.pause.count());
+	details::write_buff_ln(msg.c_str(), msg.size(), stderr);
+}
+
+Heap::Guard::Guard(Heap* heap)
+	:_previous(gc::current_heap)
+{
+	gc::current_heap = heap;
+}
+
+Heap::Guard::~Guard()
+{
+	gc::current_heap = _previous;
+}
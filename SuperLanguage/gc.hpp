@@ -0,0 +1,110 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "object.hpp"
+
+struct HeapStats
+{
+	size_t collections = 0;
+	size_t live_objects = 0;
+	size_t live_bytes = 0;
+	size_t freed_objects = 0;
+	size_t freed_bytes = 0;
+	size_t pages = 0;
+	std::chrono::microseconds pause{ 0 };
+};
+
+// Optional mark-sweep heap. Objects allocated while a heap is current live
+// in size-segregated pages and are no longer freed when their reference
+// count drops to zero, the collector reclaims them instead, cycles included.
+//
+// Roots are found precisely from the reference counts: every reference
+// held outside the heap (interpreter stack, return value, StackValue
+// constants, locals of internal functions) keeps its target alive, so a
+// collection is safe at any allocation.
+//
+// Objects marked shared may be used by workers while the heap collects.
+// Their counts are read atomically and their children are never traced,
+// so a cycle of shared objects is kept until the heap is destroyed.
+class Heap
+{
+public:
+	Heap();
+	Heap(const Heap&) = delete;
+	Heap& operator=(const Heap&) = delete;
+	~Heap();
+
+	static Heap* get_current();
+
+	void* allocate(size_t size);
+
+	void track(Object* obj);
+
+	void collect();
+
+	const HeapStats& get_stats() const { return _stats; }
+
+	void set_report(bool report) { _report = report; }
+
+	// Makes the heap current for the calling thread for the guard lifetime
+	class Guard
+	{
+	public:
+		explicit Guard(Heap* heap);
+		Guard(const Guard&) = delete;
+		Guard& operator=(const Guard&) = delete;
+		~Guard();
+
+	private:
+		Heap* _previous;
+	};
+
+private:
+	static constexpr size_t size_step = 16;
+	static constexpr size_t max_small_size = 256;
+	static constexpr size_t page_size = 64 * 1024;
+	static constexpr size_t class_count = max_small_size / size_step;
+	static constexpr size_t min_threshold = 16 * 1024;
+
+	struct FreeSlot
+	{
+		FreeSlot* next;
+	};
+
+	struct SizeClass
+	{
+		std::vector<std::unique_ptr<std::byte[]>> pages;
+		FreeSlot* free_list = nullptr;
+	};
+
+	// Stored in front of every object allocated by the heap
+	struct alignas(16) Header
+	{
+		size_t size;
+		int64_t gc_refs;
+	};
+
+	static Header* get_header(const Object* obj);
+
+	static size_t get_class_index(size_t size);
+
+	void add_page(SizeClass& size_class, size_t slot_size);
+
+	void free_object(Object* obj);
+
+	void destroy_all();
+
+	void report() const;
+
+	std::array<SizeClass, class_count> _classes;
+	std::vector<Object*> _objects;
+	size_t _threshold = min_threshold;
+	bool _collecting = false;
+	bool _report = true;
+	HeapStats _stats;
+};
@@ -0,0 +1,49 @@
+#include "generator.hpp"
+
+#include <utility>
+
+#include "interpreter.hpp"
+
+GeneratorObj::GeneratorObj(Function* func, std::vector<ObjectPtr> args)
+{
+	_frame.func = func;
+	_frame.locals = std::move(args);
+}
+
+bool GeneratorObj::has_next(Interpreter* interp)
+{
+	return fetch(interp);
+}
+
+ObjectPtr GeneratorObj::next(Interpreter* interp)
+{
+	if (!fetch(interp))
+	{
+		return {};
+	}
+	return std::exchange(_next, {});
+}
+
+bool GeneratorObj::fetch(Interpreter* interp)
+{
+	if (!_next && !_frame.finished)
+	{
+		_next = interp->resume(_frame);
+	}
+	return static_cast<bool>(_next);
+}
+
+void GeneratorObj::trace(Tracer& tracer)
+{
+	for (const auto& local : _frame.locals)
+	{
+		tracer.visit(local.get());
+	}
+	tracer.visit(_next.get());
+}
+
+void GeneratorObj::clear_references()
+{
+	_frame.locals.clear();
+	_next.reset();
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <vector>
+
+#include "object.hpp"
+
+class Interpreter;
+
+// Position inside a suspended function, one per scope, loop or if between
+// the function body and the yield. child is the scope child that
+// suspended or the taken branch of an if, frame_base the scope start
+// relative to the call base. Range loops keep their iteration and end.
+struct ResumePoint
+{
+	size_t child = 0;
+	size_t frame_base = 0;
+	int counter = 0;
+	int end = 0;
+};
+
+// Activation record of a generator. While suspended the arguments and
+// locals live here instead of on the interpreter stack, resuming puts them
+// back and walks the resume path down to the statement after the yield.
+struct CoroutineFrame
+{
+	Function* func = nullptr;
+	std::vector<ObjectPtr> locals;
+	// Innermost point first, consumed from the back on resume
+	std::vector<ResumePoint> resume_path;
+	bool running = false;
+	bool finished = false;
+};
+
+// Iterator returned by calling a function that contains yield. The body
+// runs lazily up to the next yield every time a value is requested, on the
+// interpreter asking for it. The one that called the function may be gone
+// by then, e.g. when a task returned the generator.
+class GeneratorObj final : public IteratorObj
+{
+public:
+	GeneratorObj(Function* func, std::vector<ObjectPtr> args);
+
+	bool has_next(Interpreter* interp) override;
+
+	ObjectPtr next(Interpreter* interp) override;
+
+	void trace(Tracer& tracer) override;
+
+	void clear_references() override;
+
+private:
+	// Runs to the next yield unless a value is already waiting
+	bool fetch(Interpreter* interp);
+
+	CoroutineFrame _frame;
+	ObjectPtr _next;
+};
@@ -1,22 +1,45 @@
 #include "interpreter.hpp"
 #include "log.hpp"
+#include "parallel.hpp"
+#include "stats.hpp"
+#include "task.hpp"
+#include "trace.hpp"
 #include <cassert>
+#include <iterator>
+#include <thread>
 
-Interpreter::Interpreter(Node* scope)
-	:_root_scope(scope)
-	,_current_scope(dynamic_cast<Scope*>(scope))
+Interpreter::Interpreter(std::shared_ptr<const Program> program)
+	:_program(std::move(program))
+	,_current_scope(dynamic_cast<Scope*>(_program->get_root()))
+	,_functions(_program->get_functions())
 {}
 
 Interpreter::~Interpreter()
 {
-	delete _root_scope;
+	if (_profiler)
+	{
+		_profiler->detach(_profile_stack);
+	}
+	_stack.clear();
+	_return_value.reset();
+	_heap.reset();
 }
 
 void Interpreter::run()
 {
-	if (_root_scope)
+	if (Node* root = _program->get_root())
 	{
-		_root_scope->accept(*this);
+		Heap::Guard heap_guard{ _heap.get() };
+		Output::Guard output_guard{ &_output };
+		if (_profile_stack)
+		{
+			_profile_stack->push(nullptr);
+		}
+		root->accept(*this);
+		if (_profile_stack)
+		{
+			_profile_stack->pop();
+		}
 	}
 }
 
@@ -40,35 +63,285 @@ size_t Interpreter::get_stack_size() const
 	return _stack.size();
 }
 
-void Interpreter::add_internal_function(InternalFunction* func)
+std::span<const ObjectPtr> Interpreter::get_stack_slice(size_t from) const
 {
-	_functions[func->get_name()] = func;
+	return std::span<const ObjectPtr>{ _stack }.subspan(std::min(from, _stack.size()));
+}
+
+Function* Interpreter::find_function(std::string_view name) const
+{
+	const auto it = _functions.find(name);
+	return it != _functions.end() ? it->second : nullptr;
+}
+
+std::unique_ptr<Interpreter> Interpreter::make_worker() const
+{
+	auto worker = std::make_unique<Interpreter>(_program);
+	worker->_functions = _functions;
+	worker->_output.set_policy(FlushPolicy::Line);
+	// Starts empty and takes its first step from the shared tank
+	worker->_fuel_tank = _fuel_tank;
+	if (_fuel_tank)
+	{
+		worker->_fuel = 0;
+	}
+	if (_profiler)
+	{
+		worker->_profiler = _profiler;
+		worker->_profile_stack = _profiler->attach(_profile_stack);
+	}
+	return worker;
+}
+
+ObjectPtr Interpreter::call_function(Function* func, std::span<const ObjectPtr> args)
+{
+	Heap::Guard heap_guard{ _heap.get() };
+	Output::Guard output_guard{ &_output };
+
+	const auto base_index = _stack.size();
+	_stack.insert(_stack.end(), args.begin(), args.end());
+	return invoke(func, base_index);
+}
+
+ObjectPtr Interpreter::resume(CoroutineFrame& frame)
+{
+	if (frame.running)
+	{
+		LOG_ERROR("Generator {} is already running", frame.func->get_name());
+		return {};
+	}
+
+	Heap::Guard heap_guard{ _heap.get() };
+	Output::Guard output_guard{ &_output };
+
+	const auto base_index = _stack.size();
+	_stack.insert(_stack.end(), std::make_move_iterator(frame.locals.begin()), std::make_move_iterator(frame.locals.end()));
+	frame.locals.clear();
+
+	const auto parent = std::exchange(_coroutine, &frame);
+	frame.running = true;
+	_call_stack.emplace_back(frame.func, base_index);
+	if (_profile_stack)
+	{
+		_profile_stack->push(frame.func);
+	}
+	frame.func->run(this, base_index);
+	if (_profile_stack)
+	{
+		_profile_stack->pop();
+	}
+	_call_stack.pop_back();
+	frame.running = false;
+	_coroutine = parent;
+
+	// Return values of generators are dropped, only yields produce values
+	_return_value.reset();
+	_stack.resize(base_index);
+	if (!std::exchange(_suspending, false))
+	{
+		frame.finished = true;
+		return {};
+	}
+	return std::exchange(_yield_value, {});
+}
+
+void Interpreter::run_iterations(ForRange* loop, std::span<const ObjectPtr> frame, int begin, int end)
+{
+	Output::Guard output_guard{ &_output };
+
+	_stack.assign(frame.begin(), frame.end());
+	const auto scope = loop->get_scope();
+	for (int i = begin; i < end; ++i)
+	{
+		STATS_COUNT(stats::Counter::ForIteration);
+		set_stack_variable(loop->get_var_index(), Integer::make(i));
+		scope->accept(*this);
+		charge_fuel();
+		if (_halted)
+		{
+			break;
+		}
+	}
+	_stack.clear();
+}
+
+ObjectPtr Interpreter::invoke(Function* func, size_t base_index)
+{
+	charge_fuel();
+	if (_halted)
+	{
+		_stack.resize(base_index);
+		return {};
+	}
+
+	if (func->is_generator())
+	{
+		// Arguments become the first locals of the frame, the body runs on demand
+		std::vector<ObjectPtr> args{ std::make_move_iterator(_stack.begin() + base_index), std::make_move_iterator(_stack.end()) };
+		_stack.resize(base_index);
+		return make_object<GeneratorObj>(func, std::move(args));
+	}
+
+	_call_stack.emplace_back(func, base_index);
+	STATS_STACK(_stack.size(), _call_stack.size());
+	if (_profile_stack)
+	{
+		_profile_stack->push(func);
+	}
+	func->run(this, base_index);
+	if (_profile_stack)
+	{
+		_profile_stack->pop();
+	}
+	_call_stack.pop_back();
+	// Natives like __await and __parallel_map return null once their workers ran dry
+	if (func->is_native())
+	{
+		halt_if_tank_empty();
+	}
+
+	// Internal functions leave their arguments behind, drop them together
+	// with the frame and hand the result over as a plain temporary.
+	_stack.resize(base_index);
+	return std::exchange(_return_value, {});
 }
 
 void Interpreter::run_once(Node* node)
 {
+	// Functions defined here may run on workers
+	Program::share_constants(node);
+
+	Heap::Guard heap_guard{ _heap.get() };
+	Output::Guard output_guard{ &_output };
+	if (_profile_stack)
+	{
+		_profile_stack->push(nullptr);
+		_profile_stack->set_line(node->get_line());
+	}
 	node->accept(*this);
+	details::flush_log();
+	if (_profile_stack)
+	{
+		_profile_stack->pop();
+	}
+}
+
+void Interpreter::set_gc_enabled(bool enabled)
+{
+	if (enabled && !_heap)
+	{
+		_heap = std::make_unique<Heap>();
+	}
+	else if (!enabled)
+	{
+		_heap.reset();
+	}
+}
+
+void Interpreter::set_profiler(std::shared_ptr<Profiler> profiler)
+{
+	if (_profiler)
+	{
+		_profiler->detach(_profile_stack);
+		_profile_stack = nullptr;
+	}
+	_profiler = std::move(profiler);
+	if (_profiler)
+	{
+		_profile_stack = _profiler->attach();
+	}
+}
+
+void Interpreter::set_fuel_limits(const FuelLimits& limits)
+{
+	if (limits.budget > 0 || limits.slice > 0)
+	{
+		_fuel_tank = std::make_shared<FuelTank>(limits);
+		_fuel = 0;
+	}
+	else
+	{
+		_fuel_tank.reset();
+		_fuel = std::numeric_limits<int64_t>::max();
+	}
+}
+
+void Interpreter::refuel()
+{
+	if (!_fuel_tank)
+	{
+		_fuel = std::numeric_limits<int64_t>::max();
+		return;
+	}
+
+	// End of a slice, give the core to other scripts
+	if (_fuel_tank->get_limits().slice > 0)
+	{
+		std::this_thread::yield();
+	}
+
+	_fuel = _fuel_tank->take();
+	if (_fuel == 0)
+	{
+		halt();
+	}
+}
+
+void Interpreter::halt()
+{
+	_halted = true;
+	// Charges are pointless from here on, keep them off the tank
+	_fuel = std::numeric_limits<int64_t>::max();
+	if (_fuel_tank->report_empty())
+	{
+		LOG_ERROR("Script stopped, fuel budget of {} units spent", _fuel_tank->get_limits().budget);
+	}
 }
 
 void Interpreter::visit(Scope* node)
 {
+	STATS_COUNT(stats::Counter::Scope);
+	// Scope nodes hold no runtime state, so one program can run on several
+	// interpreters. Locals are dropped here, call arguments by the caller.
 	const auto parent_scope = _current_scope;
 	_current_scope = node;
-	if (parent_scope)
-	{
-		_current_scope->set_stack_base(parent_scope->get_stack_base());
-	}
+	auto frame_base = _stack.size();
 	auto& nodes = node->get_nodes();
+	// Diagnostics of a top level statement show up before the next one runs
+	const bool top_level = node == _program->get_root();
 
-	for (Node* child : nodes)
+	size_t first = 0;
+	if (is_resuming())
 	{
-		child->accept(*this);
+		// Innermost scope continues after the yield, outer ones re-enter the
+		// statement that suspended
+		const auto point = pop_resume_point();
+		frame_base = get_absolute_address(point.frame_base);
+		first = is_resuming() ? point.child : point.child + 1;
 	}
 
-	if (_current_scope)
+	for (size_t i = first; i < nodes.size(); ++i)
 	{
-		_stack.resize(_stack.size() - _current_scope->get_variable_count());
+		if (_profile_stack)
+		{
+			_profile_stack->set_line(nodes[i]->get_line());
+		}
+		nodes[i]->accept(*this);
+		if (top_level)
+		{
+			details::flush_log();
+		}
+		if (_suspending || _halted)
+		{
+			if (_suspending)
+			{
+				push_resume_point(i, frame_base);
+			}
+			break;
+		}
 	}
+
+	_stack.resize(frame_base);
 	_current_scope = parent_scope;
 }
 
@@ -76,7 +349,12 @@ void Interpreter::visit(BinaryOperation* node)
 {
 	node->get_left()->accept(*this);
 	node->get_right()->accept(*this);
+	if (_halted)
+	{
+		return;
+	}
 
+	STATS_COUNT(static_cast<stats::Counter>(node->get_operation()));
 	switch (node->get_operation())
 	{
 	case Operation::Plus:			eval_plus();			break;
@@ -93,6 +371,7 @@ void Interpreter::visit(BinaryOperation* node)
 
 void Interpreter::visit(Variable* node)
 {
+	STATS_COUNT(stats::Counter::VariableRead);
 	const auto index = get_absolute_address(node->get_stack_index());
 
 	if(index < _stack.size())
@@ -107,14 +386,19 @@ void Interpreter::visit(Variable* node)
 
 void Interpreter::visit(Assign* node)
 {
+	STATS_COUNT(stats::Counter::Assign);
 	if(auto scope = dynamic_cast<Scope*>(node->get_expression()))
 	{
-		_stack.push_back(std::make_shared<Callable>(scope));
+		_stack.push_back(make_object<Callable>(scope));
 	}
 	else
 	{
 		node->get_expression()->accept(*this);
 	}
+	if (_halted)
+	{
+		return;
+	}
 
 	const auto val = _stack.back();
 	_stack.pop_back();
@@ -126,17 +410,19 @@ void Interpreter::visit(Assign* node)
 	}
 	else if (!set_stack_variable(node->get_var_index(), val))
 	{
-		LOG_INFO("Failed to assign, variable \'{}\' not exist in current scope", node->get_var_index());
+		LOG_INFO(LogCategory::Stack, "Failed to assign, variable \'{}\' not exist in current scope", node->get_var_index());
 	}
 }
 
 void Interpreter::visit(StackValue* node)
 {
+	STATS_COUNT(stats::Counter::Value);
 	_stack.emplace_back(node->get_object());
 }
 
 void Interpreter::visit(ArrayNode* node)
 {
+	STATS_COUNT(stats::Counter::ArrayLiteral);
 	const auto& array_nodes = node->get_array_nodes();
 
 	std::vector<ObjectPtr> array_objects;
@@ -153,7 +439,7 @@ void Interpreter::visit(ArrayNode* node)
 		}
 	}
 
-	_stack.emplace_back(std::make_shared<ArrayObj>(array_objects));
+	_stack.emplace_back(make_object<ArrayObj>(array_objects));
 }
 
 void Interpreter::visit(Function* node)
@@ -174,40 +460,65 @@ void Interpreter::visit(Call* node)
 {
 	if(const auto func = get_function(node))
 	{
-		LOG_INFO("Call function {}", func->get_name());
+		STATS_COUNT(stats::Counter::Call);
+		LOG_INFO(LogCategory::Calls, "Call function {}", func->get_name());
 		
 		const auto base_index = _stack.size();
-		const auto fn_scope = func->get_scope();
-		fn_scope->reset();
 		const auto& args = node->get_args();
-		LOG_INFO("Function args begin");
 		for(const auto arg : args)
 		{
-			const auto prev_size = _stack.size();
 			arg->accept(*this);
-			fn_scope->add_variable();
-			const auto str_val = print_value(_stack.back());
-			LOG_INFO("Arg {} set value to {}", prev_size, str_val);
+			LOG_DEBUG(LogCategory::Calls, "Arg {} set value to {}", _stack.size() - 1, print_value(_stack.back()));
 		}
-		LOG_INFO("Function args end");
 
-		_call_stack.emplace_back(func->get_name(), base_index);
-		func->run(this, base_index);
-
-		if(_return_value)
+		ObjectPtr result;
+		{
+			const trace::Span span{ func->is_native() ? trace::Category::Builtin : trace::Category::Call, func->get_name() };
+			result = invoke(func, base_index);
+		}
+		if(result && !node->is_statement())
 		{
-			constexpr auto ret_index = 0;
-			allocate_stack_variable(ret_index);
-			set_stack_variable(ret_index, std::move(_return_value));
+			_stack.emplace_back(std::move(result));
 		}
-		_call_stack.pop_back();
 
-		LOG_INFO("Function call end {}", func->get_name());
+		LOG_INFO(LogCategory::Calls, "Function call end {}", func->get_name());
+	}
+}
+
+void Interpreter::visit(Spawn* node)
+{
+	STATS_COUNT(stats::Counter::Spawn);
+	const auto call = node->get_call();
+	const auto func = get_function(call);
+	if (!func)
+	{
+		LOG_ERROR("Function {} not found", call->get_function_name());
+		return;
+	}
+
+	const auto base_index = _stack.size();
+	for (const auto arg : call->get_args())
+	{
+		arg->accept(*this);
+	}
+	if (_halted)
+	{
+		_stack.resize(base_index);
+		return;
+	}
+	std::vector<ObjectPtr> args{ std::make_move_iterator(_stack.begin() + base_index), std::make_move_iterator(_stack.end()) };
+	_stack.resize(base_index);
+
+	auto task = TaskObj::spawn(this, func, std::move(args));
+	if (!call->is_statement())
+	{
+		_stack.emplace_back(std::move(task));
 	}
 }
 
 void Interpreter::visit(Return* node)
 {
+	STATS_COUNT(stats::Counter::Return);
 	if(const auto expr = node->get_expression())
 	{
 		const auto prev_size = _stack.size();
@@ -221,17 +532,64 @@ void Interpreter::visit(Return* node)
 	}
 }
 
-void Interpreter::visit(BranchIfElse* node)
+void Interpreter::visit(Yield* node)
 {
+	STATS_COUNT(stats::Counter::Yield);
+	if (!_coroutine || _call_stack.empty() || _call_stack.back().first != _coroutine->func)
+	{
+		LOG_ERROR("yield is only allowed in the body of a function");
+		return;
+	}
+
+	const auto prev_size = _stack.size();
 	node->get_expression()->accept(*this);
+	if (_halted)
+	{
+		return;
+	}
+	if (_stack.size() > prev_size)
+	{
+		_yield_value = _stack.back();
+		_stack.pop_back();
+	}
+	if (!_yield_value)
+	{
+		LOG_ERROR("Failed to yield from {}, value expected", _coroutine->func->get_name());
+		return;
+	}
+
+	// Yield is a statement, everything above the call base is a local
+	const auto base_index = _call_stack.back().second;
+	_coroutine->locals.assign(_stack.begin() + base_index, _stack.end());
+	_suspending = true;
+}
+
+void Interpreter::visit(BranchIfElse* node)
+{
+	STATS_COUNT(stats::Counter::Branch);
 	bool value;
-	if(pop_stack(value))
+	if (is_resuming())
 	{
-		node->execute(*this, value);
+		value = pop_resume_point().child == 0;
 	}
 	else
 	{
-		LOG_ERROR("Failed to execute if statement, bool value expected");
+		node->get_expression()->accept(*this);
+		if (_halted)
+		{
+			return;
+		}
+		if (!pop_stack(value))
+		{
+			LOG_ERROR("Failed to execute if statement, bool value expected");
+			return;
+		}
+	}
+
+	node->execute(*this, value);
+	if (_suspending)
+	{
+		push_resume_point(value ? 0 : 1, 0);
 	}
 }
 
@@ -245,25 +603,116 @@ void Interpreter::visit(Loop* node)
 		return;
 	}
 
-	bool value = false;
-	do
+	// A resumed loop continues inside its body before checking the condition
+	bool resumed = is_resuming();
+	if (resumed)
 	{
-		expr->accept(*this);
-		if (pop_stack(value))
+		pop_resume_point();
+	}
+
+	while (true)
+	{
+		if (!resumed)
 		{
+			expr->accept(*this);
+			if (_halted)
+			{
+				break;
+			}
+			bool value = false;
+			if (!pop_stack(value))
+			{
+				LOG_ERROR("Failed to execute loop statement, bool value expected");
+				break;
+			}
 			if (!value)
 			{
 				break;
 			}
-			scope->accept(*this);
 		}
-		else
+		resumed = false;
+
+		STATS_COUNT(stats::Counter::LoopIteration);
+		scope->accept(*this);
+		if (_suspending)
+		{
+			push_resume_point(0, 0);
+			break;
+		}
+		charge_fuel();
+		if (_halted)
 		{
-			LOG_ERROR("Failed to execute loop statement, bool value expected");
 			break;
 		}
 	}
-	while (value);
+}
+
+void Interpreter::visit(ForRange* node)
+{
+	const auto scope = node->get_scope();
+	if (!scope)
+	{
+		LOG_ERROR("Failed to execute for loop, no scope to execute");
+		return;
+	}
+
+	int begin = 0;
+	int end = 0;
+	// A resumed loop continues inside its body, the variable is restored with the locals
+	bool resumed = is_resuming();
+	if (resumed)
+	{
+		const auto point = pop_resume_point();
+		begin = point.counter;
+		end = point.end;
+	}
+	else
+	{
+		node->get_begin()->accept(*this);
+		node->get_end()->accept(*this);
+		if (_halted)
+		{
+			return;
+		}
+		if (!pop_stack(end) || !pop_stack(begin))
+		{
+			LOG_ERROR("Failed to execute for loop, int range bounds expected");
+			return;
+		}
+		allocate_stack_variable(node->get_var_index());
+	}
+
+	if (!resumed && node->is_parallel() && end - begin > 1)
+	{
+		const auto frame_base = get_absolute_address(0);
+		parallel::for_range(this, node, get_stack_slice(frame_base), begin, end);
+		halt_if_tank_empty();
+	}
+	else
+	{
+		for (int i = begin; i < end; ++i)
+		{
+			if (!resumed)
+			{
+				set_stack_variable(node->get_var_index(), Integer::make(i));
+			}
+			resumed = false;
+
+			STATS_COUNT(stats::Counter::ForIteration);
+			scope->accept(*this);
+			if (_suspending)
+			{
+				push_resume_point(0, 0, i, end);
+				return;
+			}
+			charge_fuel();
+			if (_halted)
+			{
+				break;
+			}
+		}
+	}
+	_stack.resize(get_absolute_address(node->get_var_index()));
 }
 
 void Interpreter::eval_plus()
@@ -274,7 +723,7 @@ void Interpreter::eval_plus()
 		std::string lvalue;
 		if (pop_stack(rvalue) && pop_stack(lvalue))
 		{
-			_stack.emplace_back(std::make_shared<String>(lvalue + rvalue));
+			_stack.emplace_back(make_object<String>(lvalue + rvalue));
 		}
 		else
 		{
@@ -375,9 +824,7 @@ void Interpreter::allocate_stack_variable(size_t index)
 	{
 		_stack.resize(index + 1);
 		
-		_current_scope->add_variable();
-
-		LOG_INFO("Allocate on stack {}", index);
+		LOG_DEBUG(LogCategory::Stack, "Allocate on stack {}", index);
 	}
 }
 
@@ -389,16 +836,34 @@ bool Interpreter::set_stack_variable(size_t index, ObjectPtr object)
 	{
 		_stack[index] = object;
 
-		LOG_INFO("Var {} set to {}", index, print_value(object));
+		LOG_DEBUG(LogCategory::Stack, "Var {} set to {}", index, print_value(object));
 	}
 	return res;
 }
 
+ResumePoint Interpreter::pop_resume_point()
+{
+	const auto point = _coroutine->resume_path.back();
+	_coroutine->resume_path.pop_back();
+	return point;
+}
+
+void Interpreter::push_resume_point(size_t child, size_t frame_base, int counter, int end)
+{
+	const auto base_index = _call_stack.back().second;
+	_coroutine->resume_path.push_back({ child, frame_base - std::min(frame_base, base_index), counter, end });
+}
+
 Function* Interpreter::get_function(Call* node)
 {
-	const std::string name{node->get_function_name()};
-	if (const auto it = _functions.find(name); it != _functions.end())
+	if (const auto func = node->get_resolved_function())
+	{
+		return func;
+	}
+
+	if (const auto it = _functions.find(node->get_function_name()); it != _functions.end())
 	{
+		node->set_resolved_function(it->second);
 		return it->second;
 	}
 	else
@@ -2,15 +2,27 @@
 
 #include "nodes.hpp"
 #include <format>
+#include <limits>
+#include <memory>
+#include <span>
 
+#include "fuel.hpp"
+#include "gc.hpp"
+#include "generator.hpp"
 #include "log.hpp"
 #include "number.hpp"
+#include "output.hpp"
+#include "profiler.hpp"
+#include "program.hpp"
 
 
+// One isolate running a program: stack, collector heap and output belong to
+// the interpreter, the program is only read. Interpreters of one program
+// may run on different threads at the same time.
 class Interpreter final : public NodeVisitor
 {
 public:
-	Interpreter(Node* scope);
+	explicit Interpreter(std::shared_ptr<const Program> program);
 	Interpreter(const Interpreter&) = delete;
 	Interpreter(Interpreter&&) = delete;
 	~Interpreter() override;
@@ -19,15 +31,56 @@ public:
 
 	ObjectPtr get_stack_variable(size_t index) const;
 
+	// Values from the given absolute index up to the top of the stack
+	std::span<const ObjectPtr> get_stack_slice(size_t from) const;
+
 	void put_on_stack(ObjectPtr obj);
 
 	size_t get_stack_size() const;
 
-	void add_internal_function(InternalFunction* func);
-
 	void run_once(Node* node);
 
-	const std::vector<std::pair<std::string, size_t>>& get_call_stack() const
+	Function* find_function(std::string_view name) const;
+
+	// Interpreter for another thread running functions of this program,
+	// including the ones defined so far. It has its own stack and output and
+	// allocates outside the collector heap.
+	std::unique_ptr<Interpreter> make_worker() const;
+
+	// Runs func with the given arguments, returns what it returned
+	ObjectPtr call_function(Function* func, std::span<const ObjectPtr> args);
+
+	// Runs a generator to its next yield and returns the yielded value, null
+	// once the function has finished
+	ObjectPtr resume(CoroutineFrame& frame);
+
+	// Runs the iterations [begin, end) of a parallel for on a copy of the
+	// frame it was started from, worker interpreters only
+	void run_iterations(ForRange* loop, std::span<const ObjectPtr> frame, int begin, int end);
+
+	const std::map<std::string, Function*, std::less<>>& get_functions() const { return _functions; }
+
+	const Program& get_program() const { return *_program; }
+
+	// Switches object allocation to the tracing collector heap
+	void set_gc_enabled(bool enabled);
+
+	// Limits the work of the script, workers started from here share the
+	// budget. Once it is spent the script stops with an error.
+	void set_fuel_limits(const FuelLimits& limits);
+
+	// True after the script was stopped for running out of fuel
+	bool is_halted() const { return _halted; }
+
+	// Publishes the call stack of this interpreter and of the workers started
+	// from it to the profiler
+	void set_profiler(std::shared_ptr<Profiler> profiler);
+
+	Heap* get_heap() const { return _heap.get(); }
+
+	Output& get_output() { return _output; }
+
+	const std::vector<std::pair<const Function*, size_t>>& get_call_stack() const
 	{
 		return _call_stack;
 	}
@@ -57,12 +110,18 @@ private:
 
 	void visit(Call* node) override;
 
+	void visit(Spawn* node) override;
+
 	void visit(Return* node) override;
 
+	void visit(Yield* node) override;
+
 	void visit(BranchIfElse* node) override;
 
 	void visit(Loop* node) override;
 
+	void visit(ForRange* node) override;
+
 	void eval_plus();
 
 	void eval_minus();
@@ -137,7 +196,7 @@ private:
 			{
 				const auto res = left_num->perform_bool_op<Op>(*right_num);
 
-				_stack.emplace_back(std::make_shared<Bool>(res));
+				_stack.emplace_back(Bool::make(res));
 
 				return true;
 			}
@@ -155,11 +214,58 @@ private:
 	bool set_stack_variable(size_t index, ObjectPtr object);
 
 	Function* get_function(Call* node);
+
+	ObjectPtr invoke(Function* func, size_t base_index);
+
+	// Spends a unit of fuel, at loop back edges and calls
+	void charge_fuel()
+	{
+		if (--_fuel <= 0) [[unlikely]]
+		{
+			refuel();
+		}
+	}
+
+	void refuel();
+
+	// Stops the script once the shared budget is spent
+	void halt();
+
+	// After work done by workers, which may have spent the shared budget
+	void halt_if_tank_empty()
+	{
+		if (_fuel_tank && !_halted && _fuel_tank->is_empty())
+		{
+			halt();
+		}
+	}
+
+	// True while a resumed generator walks back to its yield
+	bool is_resuming() const { return _coroutine && !_coroutine->resume_path.empty(); }
+
+	ResumePoint pop_resume_point();
+
+	// Records where the unwinding generator continues, relative to its call base
+	void push_resume_point(size_t child, size_t frame_base, int counter = 0, int end = 0);
 private:
-	Node* _root_scope;
+	std::shared_ptr<const Program> _program;
 	Scope* _current_scope;
-	std::map<std::string, Function*> _functions;
+	std::map<std::string, Function*, std::less<>> _functions;
 	std::vector<ObjectPtr> _stack;
 	ObjectPtr _return_value;
-	std::vector<std::pair<std::string, size_t>> _call_stack;
+	std::vector<std::pair<const Function*, size_t>> _call_stack;
+	// Innermost running generator, _suspending is set from its yield until
+	// its body has unwound back to resume
+	CoroutineFrame* _coroutine = nullptr;
+	bool _suspending = false;
+	ObjectPtr _yield_value;
+	// Null for unlimited runs, the countdown then never gets to refuel in practice
+	std::shared_ptr<FuelTank> _fuel_tank;
+	int64_t _fuel = std::numeric_limits<int64_t>::max();
+	// Set when the fuel ran out, statements unwind like on a yield
+	bool _halted = false;
+	std::shared_ptr<Profiler> _profiler;
+	Profiler::Stack* _profile_stack = nullptr;
+	std::unique_ptr<Heap> _heap;
+	Output _output{ stdout };
 };
@@ -4,6 +4,7 @@
 #include <cctype>
 #include <charconv>
 #include <format>
+#include <iterator>
 #include <map>
 
 #include "log.hpp"
@@ -11,35 +12,41 @@
 
 
 namespace expects {
-	constexpr uint32_t LITERALS = TT_NumberLiteral | TT_StringLiteral | TT_BoolLiteral;
-	constexpr uint32_t LET = TT_Id;
-	constexpr uint32_t SCOPE_BEGIN = TT_Let | TT_Id | TT_ScopeBegin | TT_Fn | TT_Ret | TT_If | TT_Loop;
-	constexpr uint32_t SCOPE_END = TT_Let | TT_Id | TT_ScopeBegin | TT_Fn | TT_Ret | TT_If | TT_Else | TT_Loop;
+	constexpr uint64_t LITERALS = TT_NumberLiteral | TT_StringLiteral | TT_BoolLiteral;
+	constexpr uint64_t LET = TT_Id;
+	constexpr uint64_t SCOPE_BEGIN = TT_Let | TT_Id | TT_ScopeBegin | TT_Fn | TT_Ret | TT_If | TT_Loop | TT_Spawn | TT_Yield | TT_For | TT_Parallel;
+	constexpr uint64_t SCOPE_END = TT_Let | TT_Id | TT_ScopeBegin | TT_Fn | TT_Ret | TT_If | TT_Else | TT_Loop | TT_Spawn | TT_Yield | TT_For | TT_Parallel;
 	//TT_Id | TT_NumberLiteral | TT_LParen | TT_Fn | TT_StringLiteral;
-	constexpr uint32_t ASSIGN = TT_Id | TT_LParen | TT_Fn | LITERALS | TT_ArrayBegin;
-	constexpr uint32_t ID = TT_Assign | TT_Operation | TT_Semicolon | TT_LParen | TT_Coma | TT_RParen;
-	constexpr uint32_t LPAREN = TT_Id | LITERALS | TT_LParen | TT_RParen;
-	constexpr uint32_t RPAREN = TT_LParen | TT_RParen | TT_Operation | TT_ScopeBegin | TT_Semicolon;
-	constexpr uint32_t COMA = TT_Id | LITERALS;
-	constexpr uint32_t FN = TT_LParen | TT_NumberLiteral | TT_StringLiteral | TT_Id | TT_Ret;
-	constexpr uint32_t RETURN = TT_LParen | TT_NumberLiteral | TT_StringLiteral | TT_Id;
-	constexpr uint32_t NUMBER_LITERAL = TT_Operation | TT_Semicolon | TT_RParen | TT_Coma | TT_ArrayEnd;
-	constexpr uint32_t STRING_LITERAL = TT_Operation | TT_Semicolon | TT_RParen | TT_Coma | TT_ArrayEnd;
-	constexpr uint32_t BOOL_LITERAL = TT_Operation | TT_Semicolon | TT_RParen | TT_Coma | TT_ArrayEnd;
-	constexpr uint32_t OPERATION = TT_Id | TT_NumberLiteral | TT_LParen | TT_StringLiteral;
-	constexpr uint32_t IF = TT_LParen;
-	constexpr uint32_t ELSE = TT_ScopeBegin;
-	constexpr uint32_t LOOP = TT_LParen;
-	constexpr uint32_t AND = TT_Id | LITERALS;
-	constexpr uint32_t OR = TT_Id | LITERALS;
-	constexpr uint32_t GREATER = TT_Id | TT_NumberLiteral;
-	constexpr uint32_t LESS = TT_Id | TT_NumberLiteral;
-	constexpr uint32_t SEMICOLON = TT_ScopeEnd | TT_Let | TT_Id;
-	constexpr uint32_t ARRAY_BEGIN = TT_Id | LITERALS;
+	constexpr uint64_t ASSIGN = TT_Id | TT_LParen | TT_Fn | LITERALS | TT_ArrayBegin | TT_Spawn;
+	constexpr uint64_t ID = TT_Assign | TT_Operation | TT_Semicolon | TT_LParen | TT_Coma | TT_RParen | TT_In | TT_Range;
+	constexpr uint64_t LPAREN = TT_Id | LITERALS | TT_LParen | TT_RParen | TT_Spawn;
+	constexpr uint64_t RPAREN = TT_LParen | TT_RParen | TT_Operation | TT_ScopeBegin | TT_Semicolon | TT_Range;
+	constexpr uint64_t COMA = TT_Id | LITERALS | TT_Spawn;
+	constexpr uint64_t FN = TT_LParen | TT_NumberLiteral | TT_StringLiteral | TT_Id | TT_Ret | TT_Yield;
+	constexpr uint64_t RETURN = TT_LParen | TT_NumberLiteral | TT_StringLiteral | TT_Id;
+	constexpr uint64_t NUMBER_LITERAL = TT_Operation | TT_Semicolon | TT_RParen | TT_Coma | TT_ArrayEnd | TT_Range;
+	constexpr uint64_t STRING_LITERAL = TT_Operation | TT_Semicolon | TT_RParen | TT_Coma | TT_ArrayEnd;
+	constexpr uint64_t BOOL_LITERAL = TT_Operation | TT_Semicolon | TT_RParen | TT_Coma | TT_ArrayEnd;
+	constexpr uint64_t OPERATION = TT_Id | TT_NumberLiteral | TT_LParen | TT_StringLiteral;
+	constexpr uint64_t IF = TT_LParen;
+	constexpr uint64_t ELSE = TT_ScopeBegin;
+	constexpr uint64_t LOOP = TT_LParen;
+	constexpr uint64_t AND = TT_Id | LITERALS;
+	constexpr uint64_t OR = TT_Id | LITERALS;
+	constexpr uint64_t GREATER = TT_Id | TT_NumberLiteral;
+	constexpr uint64_t LESS = TT_Id | TT_NumberLiteral;
+	constexpr uint64_t SEMICOLON = TT_ScopeEnd | TT_Let | TT_Id | TT_Spawn;
+	constexpr uint64_t ARRAY_BEGIN = TT_Id | LITERALS;
+	constexpr uint64_t SPAWN = TT_Id;
+	constexpr uint64_t YIELD = RETURN;
+	constexpr uint64_t FOR = TT_Id;
+	constexpr uint64_t IN = TT_Id | TT_NumberLiteral | TT_LParen;
+	constexpr uint64_t RANGE = IN;
+	constexpr uint64_t PARALLEL = TT_For;
 }
 
-using CharTokenInfo = std::tuple< char, uint32_t>;
-std::map<uint32_t, CharTokenInfo> char_map = {
+using CharTokenInfo = std::tuple< char, uint64_t>;
+const std::map<uint64_t, CharTokenInfo> char_map = {
 	{ TT_LParen,  { '(', expects::LPAREN } },
 	{ TT_RParen, { ')', expects::RPAREN } },
 	{ TT_ScopeBegin, { '{', expects::SCOPE_BEGIN} },
@@ -51,8 +58,8 @@ std::map<uint32_t, CharTokenInfo> char_map = {
 	{ TT_ArrayEnd, { ']', TT_Semicolon } }
 };
 
-using TokenInfo = std::tuple< std::string_view, uint32_t>;
-std::map<uint32_t, TokenInfo> string_map = {
+using TokenInfo = std::tuple< std::string_view, uint64_t>;
+const std::map<uint64_t, TokenInfo> string_map = {
 	{ TT_Let,  { "let", expects::LET } },
 	{ TT_Fn, { "fn", expects::FN } },
 	{ TT_Ret, { "return", expects::RETURN } },
@@ -60,7 +67,12 @@ std::map<uint32_t, TokenInfo> string_map = {
 	{ TT_Else, { "else", expects::ELSE } },
 	{ TT_Loop, { "while", expects::LOOP } },
 	{ TT_And, { "and", expects::AND } },
-	{ TT_Or, {"or", expects::OR } }
+	{ TT_Or, {"or", expects::OR } },
+	{ TT_Spawn, { "spawn", expects::SPAWN } },
+	{ TT_Yield, { "yield", expects::YIELD } },
+	{ TT_For, { "for", expects::FOR } },
+	{ TT_In, { "in", expects::IN } },
+	{ TT_Parallel, { "parallel", expects::PARALLEL } }
 };
 
 Token::Token(TokType t, ObjectPtr v)
@@ -110,6 +122,11 @@ std::string_view Lexer::read_number() const
 		{
 			break;
 		}
+		// 0..n is a range, not a float
+		if ((*it) == '.' && it + 1 != _end && *(it + 1) == '.')
+		{
+			break;
+		}
 		++it;
 	}
 
@@ -143,7 +160,7 @@ ObjectPtr convert(const std::string_view& number)
 			number.data() + number.size(), value);
 		if (ec == std::errc())
 		{
-			return std::make_shared<Integer>(value);
+			return Integer::make(value);
 		}
 	}
 	else
@@ -153,7 +170,7 @@ ObjectPtr convert(const std::string_view& number)
 			number.data() + number.size(), value);
 		if (ec == std::errc())
 		{
-			return std::make_shared<Float>(value);
+			return make_object<Float>(value);
 		}
 	}
 
@@ -177,6 +194,7 @@ std::vector<Token> Lexer::tokenize(const std::string& expression)
 		process_line();
 	}
 
+	LOG_INFO(LogCategory::Lexer, "Tokenized {} lines into {} tokens", lines.size(), _tokens.size());
 	return _tokens;
 }
 
@@ -198,7 +216,7 @@ void Lexer::process_line()
 		++_current;
 	}
 
-	uint32_t expect = TT_Let | TT_Id | TT_ScopeBegin | TT_Fn | TT_Ret | TT_ScopeEnd | TT_If | TT_Else | TT_Loop;
+	uint64_t expect = TT_Let | TT_Id | TT_ScopeBegin | TT_Fn | TT_Ret | TT_ScopeEnd | TT_If | TT_Else | TT_Loop | TT_Spawn | TT_Yield | TT_For | TT_Parallel;
 
 	struct ScopeEnd
 	{
@@ -251,6 +269,12 @@ void Lexer::process_line()
 			continue;
 		}
 
+		if ((expect & TT_Range) && try_put_range())
+		{
+			expect = expects::RANGE;
+			continue;
+		}
+
 		if ((expect & TT_Operation) && try_put_operation())
 		{
 			expect = expects::OPERATION;
@@ -299,7 +323,7 @@ bool Lexer::try_put_token(TokType tok)
 		
 	}
 
-	LOG_INFO("Cant convert token {} to char", tok);
+	LOG_DEBUG(LogCategory::Lexer, "Cant convert token {} to char", static_cast<uint64_t>(tok));
 	return false;
 }
 
@@ -321,7 +345,7 @@ bool Lexer::try_put_keyword_token(TokType tok)
 			}
 		}
 	}
-	LOG_INFO("Cant convert token {} to string", tok);
+	LOG_DEBUG(LogCategory::Lexer, "Cant convert token {} to string", static_cast<uint64_t>(tok));
 	return false;
 }
 
@@ -335,7 +359,7 @@ bool Lexer::try_put_bool_literal()
 		if(is_true || word == "False")
 		{
 			eat(word);
-			_tokens.emplace_back(TT_BoolLiteral, std::make_shared<Bool>(is_true));
+			_tokens.emplace_back(TT_BoolLiteral, Bool::make(is_true));
 		}
 		
 
@@ -368,7 +392,7 @@ bool Lexer::try_put_string_literal()
 		const auto end = read_until(quote);
 		if (_current != end)
 		{
-			_tokens.emplace_back(TT_StringLiteral, std::make_shared<String>(std::string{_current, end}));
+			_tokens.emplace_back(TT_StringLiteral, make_object<String>(std::string{_current, end}));
 
 			_current = end;
 			eat(quote);
@@ -413,6 +437,19 @@ bool Lexer::try_put_id()
 	return false;
 }
 
+bool Lexer::try_put_range()
+{
+	skip_fillers();
+	if ((*_current) == '.' && _current + 1 != _end && *(_current + 1) == '.')
+	{
+		eat("..");
+		_tokens.emplace_back(TT_Range);
+		return true;
+	}
+
+	return false;
+}
+
 void Lexer::eat(char ch)
 {
 	if(_current != _end && (*_current) == ch)
@@ -454,6 +491,7 @@ void Lexer::fatal_error(const std::string& error_msg)
 {
 	auto offset = _current - _begin;
 	auto msg = std::format("{}:{} > {}", _current_line, offset, error_msg);
+	details::flush_log();
 	puts(msg.c_str());
 	exit(1);
 }
@@ -482,17 +520,17 @@ void Lexer::end_line()
 	}
 }
 
-bool Lexer::find_keyword(uint32_t& expect)
+bool Lexer::find_keyword(uint64_t& expect)
 {
-	constexpr uint32_t keyword_tokens[] = { TT_Let, TT_Fn, TT_Ret, TT_If, TT_Else, TT_Loop };
-	for (uint32_t i = 0; i < sizeof(keyword_tokens); ++i)
+	constexpr uint64_t keyword_tokens[] = { TT_Let, TT_Fn, TT_Ret, TT_If, TT_Else, TT_Loop, TT_Spawn, TT_Yield, TT_For, TT_In, TT_Parallel };
+	for (uint32_t i = 0; i < std::size(keyword_tokens); ++i)
 	{
 		auto token = keyword_tokens[i];
 		if ((expect & token) && try_put_keyword_token(static_cast<TokType>(token)))
 		{
 			if (auto it = string_map.find(token); it != string_map.end())
 			{
-				expect = std::get<uint32_t>(it->second);
+				expect = std::get<uint64_t>(it->second);
 				return true;
 			}
 		}
@@ -500,16 +538,16 @@ bool Lexer::find_keyword(uint32_t& expect)
 	return false;
 }
 
-bool Lexer::find_char(uint32_t& expect)
+bool Lexer::find_char(uint64_t& expect)
 {
-	constexpr uint32_t char_tokens[] = { TT_ScopeBegin, TT_ScopeEnd, TT_Assign, TT_LParen, TT_RParen, TT_Coma, TT_ArrayBegin, TT_ArrayEnd };
-	for (uint32_t token : char_tokens)
+	constexpr uint64_t char_tokens[] = { TT_ScopeBegin, TT_ScopeEnd, TT_Assign, TT_LParen, TT_RParen, TT_Coma, TT_ArrayBegin, TT_ArrayEnd };
+	for (uint64_t token : char_tokens)
 	{
 		if ((expect & token) && try_put_token(static_cast<TokType>(token)))
 		{
 			if (auto it = char_map.find(token); it != char_map.end())
 			{
-				expect = std::get<uint32_t>(it->second);
+				expect = std::get<uint64_t>(it->second);
 				return true;
 			}
 		}
@@ -517,7 +555,7 @@ bool Lexer::find_char(uint32_t& expect)
 	return false;
 }
 
-bool Lexer::find_literal(uint32_t& expect)
+bool Lexer::find_literal(uint64_t& expect)
 {
 	bool res = (expect & TT_BoolLiteral) && try_put_bool_literal();
 	if(res) 
@@ -9,7 +9,7 @@
 
 #include "number.hpp"
 
-enum TokType : uint32_t
+enum TokType : uint64_t
 {
 	TT_Let = 1 << 1,
 	TT_Operation = 1 << 2,
@@ -49,7 +49,13 @@ enum TokType : uint32_t
 	TT_Else = 1 << 27,
 	TT_Loop = 1 << 28,
 	TT_ArrayBegin = 1 << 29,
-	TT_ArrayEnd = 1 << 30
+	TT_ArrayEnd = 1 << 30,
+	TT_Spawn = 1u << 31,
+	TT_Yield = 1ull << 32,
+	TT_For = 1ull << 33,
+	TT_In = 1ull << 34,
+	TT_Range = 1ull << 35,
+	TT_Parallel = 1ull << 36
 };
 
 struct StackObject
@@ -123,6 +129,8 @@ private:
 
 	bool try_put_id();
 
+	bool try_put_range();
+
 	void eat(char ch);
 
 	void eat_current();
@@ -139,11 +147,11 @@ private:
 
 	void end_line();
 
-	bool find_keyword(uint32_t& expect);
+	bool find_keyword(uint64_t& expect);
 
-	bool find_char(uint32_t& expect);
+	bool find_char(uint64_t& expect);
 
-	bool find_literal(uint32_t& expect);
+	bool find_literal(uint64_t& expect);
 
 	void process_begin();
 
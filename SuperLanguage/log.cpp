@@ -1,7 +1,124 @@
 #include "log.hpp"
 
+#include <algorithm>
+#include <array>
+
+#include "output.hpp"
+#include "utils.hpp"
+
+namespace
+{
+	constexpr std::string_view category_names[] = { "lexer", "parser", "calls", "stack" };
+	static_assert(std::size(category_names) == static_cast<size_t>(LogCategory::Count));
+
+	// Lines are formatted in place and written in batches, no allocation per line
+	struct LogBuffer
+	{
+		static constexpr size_t max_line = 1024;
+
+		std::array<char, 16 * 1024> data;
+		size_t size = 0;
+
+		~LogBuffer()
+		{
+			flush();
+		}
+
+		void flush()
+		{
+			if (size > 0)
+			{
+				details::write_buff(data.data(), size, stderr);
+				size = 0;
+			}
+		}
+	};
+
+	thread_local LogBuffer log_buffer;
+
+	// Someone is watching, lines show up as they are logged
+	const bool flush_lines = is_terminal(stderr);
+}
+
+bool set_log_levels(std::string_view spec)
+{
+	auto levels = std::to_array(details::log_levels);
+	while (!spec.empty())
+	{
+		const auto end = std::min(spec.find(','), spec.size());
+		auto name = spec.substr(0, end);
+		spec.remove_prefix(std::min(end + 1, spec.size()));
+
+		auto level = LogLevel::Info;
+		if (const auto colon = name.find(':'); colon != std::string_view::npos)
+		{
+			const auto level_name = name.substr(colon + 1);
+			if (level_name == "debug")
+			{
+				level = LogLevel::Debug;
+			}
+			else if (level_name == "off")
+			{
+				level = LogLevel::Off;
+			}
+			else if (level_name != "info")
+			{
+				return false;
+			}
+			name = name.substr(0, colon);
+		}
+
+		if (name == "all")
+		{
+			levels.fill(level);
+			continue;
+		}
+		const auto it = std::ranges::find(category_names, name);
+		if (it == std::end(category_names))
+		{
+			return false;
+		}
+		levels[std::distance(std::begin(category_names), it)] = level;
+	}
+
+	std::ranges::copy(levels, details::log_levels);
+	return true;
+}
+
 namespace details
 {
+	LogLine begin_log_line(LogCategory category)
+	{
+		const auto name = category_names[static_cast<size_t>(category)];
+		if (log_buffer.data.size() - log_buffer.size < LogBuffer::max_line + name.size() + 3)
+		{
+			log_buffer.flush();
+		}
+
+		auto out = log_buffer.data.data() + log_buffer.size;
+		*out++ = '[';
+		out = std::ranges::copy(name, out).out;
+		*out++ = ']';
+		*out++ = ' ';
+		log_buffer.size = out - log_buffer.data.data();
+		return { out, LogBuffer::max_line - 1 };
+	}
+
+	void end_log_line(size_t size)
+	{
+		log_buffer.size += std::min(size, LogBuffer::max_line - 1);
+		log_buffer.data[log_buffer.size++] = '\n';
+		if (flush_lines)
+		{
+			log_buffer.flush();
+		}
+	}
+
+	void flush_log()
+	{
+		log_buffer.flush();
+	}
+
 	void write_buff(char const* buff, size_t size, FILE* stream)
 	{
 		[[maybe_unused]] auto unused1 = fwrite(buff, 1, size, stream);
@@ -12,4 +129,28 @@ namespace details
 		[[maybe_unused]] auto unused1 = fwrite(buff, 1, size, stream);
 		[[maybe_unused]] auto unused2 = fputc('\n', stream);
 	}
+
+	void write_error_ln(char const* buff, size_t size)
+	{
+		// Diagnostics logged before the error come first
+		flush_log();
+
+		Output* output = Output::get_current();
+		if (output)
+		{
+			output->flush();
+		}
+
+		write_buff_ln(buff, size, stderr);
+
+		if (output)
+		{
+			output->write(std::string_view{ buff, size });
+			output->end_line();
+		}
+		else
+		{
+			write_buff_ln(buff, size, stdout);
+		}
+	}
 }
\ No newline at end of file
@@ -2,28 +2,86 @@
 
 #include <cstdio>
 #include <format>
+#include <string_view>
 
-#define SHOW_INFO_LOG 0
+// Diagnostic logs selectable at runtime with --log, set to 0 to build without them
+#define SHOW_INFO_LOG 1
+
+enum class LogCategory
+{
+	Lexer,
+	Parser,
+	Calls,
+	Stack,
+	Count
+};
+
+enum class LogLevel
+{
+	Off,
+	Info,
+	Debug
+};
+
+// Comma separated categories, each optionally followed by :info or :debug,
+// e.g. "calls:debug,stack". "all" selects every category. False on an
+// unknown category or level, the levels are left unchanged then.
+bool set_log_levels(std::string_view spec);
 
 namespace details
 {
+	// Set before the script starts, read by every thread
+	inline LogLevel log_levels[static_cast<size_t>(LogCategory::Count)] = {};
+
+	inline bool is_log_enabled(LogCategory category, LogLevel level)
+	{
+		return log_levels[static_cast<size_t>(category)] >= level;
+	}
+
+	// Free space for one line in the log buffer of this thread
+	struct LogLine
+	{
+		char* data;
+		size_t capacity;
+	};
+
+	LogLine begin_log_line(LogCategory category);
+
+	// Longer lines are cut at the capacity
+	void end_log_line(size_t size);
+
+	// Writes the buffered lines of this thread to stderr, also done when
+	// the buffer fills up, on errors, at thread exit, after every top
+	// level statement and after every line when stderr is a terminal
+	void flush_log();
+
 	void write_buff(char const* buff, size_t size, FILE* stream);
 	void write_buff_ln(char const* buff, size_t size, FILE* stream);
+
+	// stderr plus the script output buffer, which is flushed first to keep order
+	void write_error_ln(char const* buff, size_t size);
 }
 
+// Arguments are evaluated only when the category is enabled at that level
 #if (SHOW_INFO_LOG)
-#define LOG_INFO(fmt_str, ...) \
+#define LOG_AT(category, level, fmt_str, ...) \
 	{ \
-		const auto log_str = std::format(fmt_str, __VA_ARGS__); \
-		details::write_buff_ln(log_str.c_str(), log_str.size(), stdout); \
+		if (details::is_log_enabled(category, level)) \
+		{ \
+			const auto log_line = details::begin_log_line(category); \
+			const auto log_result = std::format_to_n(log_line.data, log_line.capacity, fmt_str, __VA_ARGS__); \
+			details::end_log_line(static_cast<size_t>(log_result.size)); \
+		} \
 	}
 #else
-#define LOG_INFO(...)
+#define LOG_AT(...)
 #endif
 
+#define LOG_INFO(category, ...) LOG_AT(category, LogLevel::Info, __VA_ARGS__)
+#define LOG_DEBUG(category, ...) LOG_AT(category, LogLevel::Debug, __VA_ARGS__)
+
 #define LOG_ERROR(fmt_str, ...) \
 	{ \
 		const auto log_str = std::format(fmt_str, __VA_ARGS__); \
-		details::write_buff_ln(log_str.c_str(), log_str.size(), stderr); \
-		details::write_buff_ln(log_str.c_str(), log_str.size(), stdout); \
-	}
\ No newline at end of file
+		details::write_error_ln(log_str.c_str(), log_str.size()); \
+	}
@@ -1,177 +1,275 @@
+#include <atomic>
+#include <cstdlib>
 #include <iostream>
 #include <map>
-#include <ranges>
 #include <vector>
 #include <string>
 
+#include "builtins.hpp"
 #include "lexer.hpp"
 #include "nodes.hpp"
 #include "parser.hpp"
 #include "interpreter.hpp"
 #include "log.hpp"
 #include "number.hpp"
+#include "program.hpp"
+#include "stats.hpp"
+#include "thread_pool.hpp"
+#include "trace.hpp"
 
-void init_internal_functions(Interpreter* interp)
+namespace
 {
-	interp->add_internal_function(new InternalFunction("__print", [](Interpreter* interp, Scope* s)
+	// Flat report to <prefix>.txt, collapsed stacks to <prefix>.folded
+	bool write_profile(const Profiler& profiler, const std::string& prefix)
+	{
+		for (const bool flat : { true, false })
 		{
-			std::string res = "--> ";
-			auto vars = s->get_variables();
-			for(auto v : vars)
+			const auto path = prefix + (flat ? ".txt" : ".folded");
+			FILE* stream = nullptr;
+			const auto status = fopen_s(&stream, path.c_str(), "w");
+			if (status != 0)
 			{
-				auto obj = interp->get_stack_variable(v);
-
-				std::string str;
-				if(obj->get(&str))
+				char buff[256];
+				if (strerror_s(buff, sizeof buff, status) == 0)
 				{
-					res += str;
-					continue;
-				}
-
-				int ival;
-				if(obj->get(&ival))
-				{
-					res += std::to_string(ival);
-					continue;
-				}
-
-				float fval;
-				if (obj->get(&fval))
-				{
-					res += std::to_string(fval);
-					continue;
-				}
-
-				bool bval;
-				if (obj->get(&bval))
-				{
-					res += (bval ? "true" : "false");
-					continue;
+					LOG_ERROR("Failed to write profile {}: {}", path, buff);
 				}
+				return false;
 			}
-
-			puts(res.c_str());
-		}));
-
-	interp->add_internal_function(new InternalFunction("__dump_callstack", [](Interpreter* interp, Scope* s)
-		{
-			puts("Callstack dump:");
-			const auto& cs = interp->get_call_stack();
-			for(const auto& key : cs | std::views::keys)
+			if (flat)
+			{
+				profiler.write_flat(stream);
+			}
+			else
 			{
-				putc('\t', stdout);
-				puts(key.c_str());
+				profiler.write_collapsed(stream);
 			}
-		}));
+			fclose(stream);
+		}
+		return true;
+	}
 
-	interp->add_internal_function(new InternalFunction("__exit", [](Interpreter* interp, Scope* s)
+	bool write_trace(const std::string& path)
+	{
+		FILE* stream = nullptr;
+		const auto status = fopen_s(&stream, path.c_str(), "w");
+		if (status != 0)
 		{
-			const auto vars = s->get_variables();
-			if (vars.size() == 1)
+			char buff[256];
+			if (strerror_s(buff, sizeof buff, status) == 0)
 			{
-				auto obj = interp->get_stack_variable(vars.back());
-				int res = 0;
-				if (obj->get(&res))
-				{
-					exit(res);
-				}
+				LOG_ERROR("Failed to write trace {}: {}", path, buff);
 			}
-		}));
+			return false;
+		}
+		trace::write(stream);
+		fclose(stream);
+		return true;
+	}
+}
 
-	interp->add_internal_function(new InternalFunction("__get_array_element", [](Interpreter* interp, Scope* s)
+int main(int argc, char** argv)
+{
+	const char* file_name = nullptr;
+	bool gc_enabled = false;
+	int isolates = 1;
+	FuelLimits fuel;
+	std::string profile_prefix;
+	std::string trace_path;
+	FlushPolicy flush_policy = is_terminal(stdout) ? FlushPolicy::Line : FlushPolicy::Size;
+	for (int i = 1; i < argc; ++i)
+	{
+		const std::string_view arg = argv[i];
+		if (arg == "--gc")
+		{
+			gc_enabled = true;
+		}
+		else if (arg == "--flush=line")
 		{
-			const auto vars = s->get_variables();
-			if (vars.size() == 2)
+			flush_policy = FlushPolicy::Line;
+		}
+		else if (arg == "--flush=size")
+		{
+			flush_policy = FlushPolicy::Size;
+		}
+		else if (arg == "--flush=exit")
+		{
+			flush_policy = FlushPolicy::Exit;
+		}
+		else if (arg.starts_with("--isolates="))
+		{
+			isolates = std::atoi(argv[i] + arg.find('=') + 1);
+			if (isolates < 1)
 			{
-				const auto array_obj = interp->get_stack_variable(vars.front());
-				const auto index_obj = interp->get_stack_variable(vars.back());
-
-				int index = 0;
-				std::vector<ObjectPtr>* arr;
-				if (array_obj->get(&arr) && index_obj->get(&index))
-				{
-					interp->set_return_value(arr->at(index));
-				}
+				std::cerr << "Invalid isolate count " << arg << '\n';
+				return EXIT_FAILURE;
 			}
-		}));
-
-	interp->add_internal_function(new InternalFunction("__set_array_element", [](Interpreter* interp, Scope* s)
+		}
+		else if (arg.starts_with("--fuel="))
 		{
-			const auto vars = s->get_variables();
-			if (vars.size() == 3)
+			fuel.budget = std::atoll(argv[i] + arg.find('=') + 1);
+			if (fuel.budget < 1)
 			{
-				const auto array_obj = interp->get_stack_variable(vars.front());
-				const auto index_obj = interp->get_stack_variable(vars[1]);
-				const auto obj = interp->get_stack_variable(vars.back());
-
-				int index = 0;
-				std::vector<ObjectPtr>* arr;
-				if (array_obj->get(&arr) && index_obj->get(&index) && obj)
-				{
-					if (arr->size() > index) 
-					{
-						(*arr)[index] = obj;
-					}
-				}
+				std::cerr << "Invalid fuel budget " << arg << '\n';
+				return EXIT_FAILURE;
 			}
-		}));
-
-	interp->add_internal_function(new InternalFunction("__get_array_size", [](Interpreter* interp, Scope* s)
+		}
+		else if (arg.starts_with("--fuel-slice="))
 		{
-			const auto vars = s->get_variables();
-			if (vars.size() == 1)
+			fuel.slice = std::atoll(argv[i] + arg.find('=') + 1);
+			if (fuel.slice < 1)
 			{
-				const auto array_obj = interp->get_stack_variable(vars.front());
-				
-				std::vector<ObjectPtr>* arr;
-				if (array_obj->get(&arr))
-				{
-					interp->set_return_value(std::make_shared<Integer>(arr->size()));
-				}
+				std::cerr << "Invalid fuel slice " << arg << '\n';
+				return EXIT_FAILURE;
 			}
-		}));
-
-	interp->add_internal_function(new InternalFunction("__array_append", [](Interpreter* interp, Scope* s)
+		}
+		else if (arg == "--profile")
+		{
+			profile_prefix = "profile";
+		}
+		else if (arg.starts_with("--profile="))
+		{
+			profile_prefix = arg.substr(arg.find('=') + 1);
+		}
+		else if (arg.starts_with("--trace="))
 		{
-			const auto vars = s->get_variables();
-			if (vars.size() == 2)
+			// Set before any thread starts, lexing and parsing are traced too
+			trace_path = arg.substr(arg.find('=') + 1);
+			trace::enabled = !trace_path.empty();
+		}
+		else if (arg.starts_with("--log="))
+		{
+			if (!set_log_levels(arg.substr(arg.find('=') + 1)))
 			{
-				const auto array_obj = interp->get_stack_variable(vars.front());
-				const auto obj = interp->get_stack_variable(vars.back());
-				std::vector<ObjectPtr>* arr;
-				if (array_obj->get(&arr) && obj)
-				{
-					arr->emplace_back(obj);
-				}
+				std::cerr << "Invalid log categories " << arg << '\n';
+				return EXIT_FAILURE;
 			}
-		}));
-}
+		}
+		else if (arg == "--stats")
+		{
+			// Set before any thread starts, parsing counts too
+			stats::enabled = true;
+		}
+		else if (!arg.starts_with("--") && !file_name)
+		{
+			file_name = argv[i];
+		}
+		else
+		{
+			std::cerr << "Unknown option " << arg << '\n';
+			return EXIT_FAILURE;
+		}
+	}
 
-int main(int argc, char** argv)
-{
-	if (argc <= 1)
+	if (!file_name)
 	{
 		std::cerr << "Invalid args, script file name missing\n";
 		return EXIT_FAILURE;
 	}
 
-	const auto file_source = readFile(argv[1]);
+	const auto file_source = readFile(file_name);
 	if(!file_source.has_value())
 	{
 		return EXIT_FAILURE;
 	}
 	Lexer lexer;
+	std::vector<Token> tokens;
+	{
+		const trace::Span span{ trace::Category::Lexer, "tokenize" };
+		tokens = lexer.tokenize(file_source.value());
+	}
+
+	Parser p{ std::move(tokens) };
+	std::shared_ptr<Program> program;
+	{
+		const trace::Span span{ trace::Category::Parser, "parse" };
+		program = std::make_shared<Program>(p.parse());
+	}
+	init_internal_functions(*program);
+
+	// Samples the script run, the interactive lines after it are left out
+	std::shared_ptr<Profiler> profiler;
+	if (!profile_prefix.empty())
+	{
+		profiler = std::make_shared<Profiler>();
+		profiler->start();
+	}
 
-	Parser p{ lexer.tokenize(file_source.value()) };
-	
-	Interpreter interpreter(p.parse());
+	// Runs the script on every isolate at once, each one with its own
+	// stack, heap and output, and exits
+	if (isolates > 1)
+	{
+		std::atomic<bool> halted = false;
+		ThreadPool::get_default().run(isolates, [&](size_t)
+			{
+				Interpreter isolate(program);
+				isolate.set_gc_enabled(gc_enabled);
+				isolate.set_fuel_limits(fuel);
+				isolate.set_profiler(profiler);
+				isolate.get_output().set_policy(flush_policy);
+				isolate.run();
+				isolate.get_output().flush();
+				if (isolate.is_halted())
+				{
+					halted.store(true, std::memory_order_relaxed);
+				}
+			});
+		if (profiler)
+		{
+			profiler->stop();
+			write_profile(*profiler, profile_prefix);
+		}
+		if (stats::enabled)
+		{
+			stats::write_report(stderr);
+		}
+		if (trace::enabled)
+		{
+			write_trace(trace_path);
+		}
+		return halted ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
 
-	init_internal_functions(&interpreter);
+	Interpreter interpreter(program);
+	interpreter.set_gc_enabled(gc_enabled);
+	interpreter.set_fuel_limits(fuel);
+	interpreter.set_profiler(profiler);
+	interpreter.get_output().set_policy(flush_policy);
+
+	// Keeps buffered output when a script or the lexer calls exit()
+	Output::Guard output_guard{ &interpreter.get_output() };
+	std::atexit([]
+		{
+			if (Output* output = Output::get_current())
+			{
+				output->flush();
+			}
+		});
 
 	interpreter.run();
+	if (profiler)
+	{
+		profiler->stop();
+		write_profile(*profiler, profile_prefix);
+		interpreter.set_profiler(nullptr);
+	}
+	if (stats::enabled)
+	{
+		interpreter.get_output().flush();
+		stats::write_report(stderr);
+	}
+	if (trace::enabled)
+	{
+		write_trace(trace_path);
+	}
+	if (interpreter.is_halted())
+	{
+		return EXIT_FAILURE;
+	}
 
 	char line[256];
 
+	interpreter.get_output().flush();
 	while (fgets(line, sizeof line, stdin) != NULL)
 	{
 		if(line[0] == '\n')
@@ -180,6 +278,7 @@ int main(int argc, char** argv)
 		}
 		Lexer lex;
 		interpreter.run_once(p.add_tokens(lex.tokenize(line)));
+		interpreter.get_output().flush();
 	}
 
 	return EXIT_SUCCESS;
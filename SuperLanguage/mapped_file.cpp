@@ -0,0 +1,274 @@
+#include "mapped_file.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <system_error>
+
+#include "log.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(const char* path)
+{
+	close();
+
+	_file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (_file == INVALID_HANDLE_VALUE)
+	{
+		_file = nullptr;
+		LOG_ERROR("Failed to open {}: {}", path, std::system_category().message(GetLastError()));
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(_file, &size))
+	{
+		LOG_ERROR("Failed to get size of {}: {}", path, std::system_category().message(GetLastError()));
+		close();
+		return false;
+	}
+
+	_size = static_cast<size_t>(size.QuadPart);
+	_open = true;
+	// Empty files can't be mapped, they are open with no content
+	if (_size == 0)
+	{
+		return true;
+	}
+
+	_mapping = CreateFileMappingA(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	void* view = _mapping ? MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	if (!view)
+	{
+		LOG_ERROR("Failed to map {}: {}", path, std::system_category().message(GetLastError()));
+		close();
+		return false;
+	}
+
+	_data = static_cast<char*>(view);
+	return true;
+}
+
+bool MappedFile::open_writable(const char* path, size_t min_size)
+{
+	close();
+
+	_file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (_file == INVALID_HANDLE_VALUE)
+	{
+		_file = nullptr;
+		LOG_ERROR("Failed to open {}: {}", path, std::system_category().message(GetLastError()));
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(_file, &size))
+	{
+		LOG_ERROR("Failed to get size of {}: {}", path, std::system_category().message(GetLastError()));
+		close();
+		return false;
+	}
+
+	_size = std::max(static_cast<size_t>(size.QuadPart), min_size);
+	_open = true;
+	_writable = true;
+	if (_size == 0)
+	{
+		return true;
+	}
+
+	// Mapping more than the file size extends the file
+	const auto mapping_size = static_cast<uint64_t>(_size);
+	_mapping = CreateFileMappingA(_file, nullptr, PAGE_READWRITE, static_cast<DWORD>(mapping_size >> 32), static_cast<DWORD>(mapping_size), nullptr);
+	void* view = _mapping ? MapViewOfFile(_mapping, FILE_MAP_WRITE, 0, 0, 0) : nullptr;
+	if (!view)
+	{
+		LOG_ERROR("Failed to map {}: {}", path, std::system_category().message(GetLastError()));
+		close();
+		return false;
+	}
+
+	_data = static_cast<char*>(view);
+	return true;
+}
+
+bool MappedFile::flush()
+{
+	if (!_writable || !_data)
+	{
+		return true;
+	}
+
+	if (!FlushViewOfFile(_data, 0) || !FlushFileBuffers(_file))
+	{
+		LOG_ERROR("Failed to flush mapped file: {}", std::system_category().message(GetLastError()));
+		return false;
+	}
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (_data)
+	{
+		flush();
+		UnmapViewOfFile(_data);
+	}
+	if (_mapping)
+	{
+		CloseHandle(_mapping);
+	}
+	if (_file)
+	{
+		CloseHandle(_file);
+	}
+
+	_data = nullptr;
+	_mapping = nullptr;
+	_file = nullptr;
+	_size = 0;
+	_open = false;
+	_writable = false;
+}
+
+#else
+
+bool MappedFile::open(const char* path)
+{
+	close();
+
+	const int fd = ::open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		LOG_ERROR("Failed to open {}: {}", path, std::generic_category().message(errno));
+		return false;
+	}
+
+	struct stat info;
+	if (fstat(fd, &info) != 0)
+	{
+		LOG_ERROR("Failed to get size of {}: {}", path, std::generic_category().message(errno));
+		::close(fd);
+		return false;
+	}
+
+	_size = static_cast<size_t>(info.st_size);
+	if (_size != 0)
+	{
+		void* view = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (view == MAP_FAILED)
+		{
+			LOG_ERROR("Failed to map {}: {}", path, std::generic_category().message(errno));
+			::close(fd);
+			_size = 0;
+			return false;
+		}
+		madvise(view, _size, MADV_SEQUENTIAL);
+		_data = static_cast<char*>(view);
+	}
+
+	// The mapping keeps the file referenced
+	::close(fd);
+	_open = true;
+	return true;
+}
+
+bool MappedFile::open_writable(const char* path, size_t min_size)
+{
+	close();
+
+	const int fd = ::open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+	{
+		LOG_ERROR("Failed to open {}: {}", path, std::generic_category().message(errno));
+		return false;
+	}
+
+	struct stat info;
+	if (fstat(fd, &info) != 0)
+	{
+		LOG_ERROR("Failed to get size of {}: {}", path, std::generic_category().message(errno));
+		::close(fd);
+		return false;
+	}
+
+	_size = static_cast<size_t>(info.st_size);
+	// Extended files are sparse, untouched pages take no disk space
+	if (_size < min_size)
+	{
+		if (ftruncate(fd, static_cast<off_t>(min_size)) != 0)
+		{
+			LOG_ERROR("Failed to resize {}: {}", path, std::generic_category().message(errno));
+			::close(fd);
+			_size = 0;
+			return false;
+		}
+		_size = min_size;
+	}
+
+	if (_size != 0)
+	{
+		void* view = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (view == MAP_FAILED)
+		{
+			LOG_ERROR("Failed to map {}: {}", path, std::generic_category().message(errno));
+			::close(fd);
+			_size = 0;
+			return false;
+		}
+		_data = static_cast<char*>(view);
+	}
+
+	::close(fd);
+	_open = true;
+	_writable = true;
+	return true;
+}
+
+bool MappedFile::flush()
+{
+	if (!_writable || !_data)
+	{
+		return true;
+	}
+
+	if (msync(_data, _size, MS_SYNC) != 0)
+	{
+		LOG_ERROR("Failed to flush mapped file: {}", std::generic_category().message(errno));
+		return false;
+	}
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (_data)
+	{
+		flush();
+		munmap(_data, _size);
+	}
+
+	_data = nullptr;
+	_size = 0;
+	_open = false;
+	_writable = false;
+}
+
+#endif
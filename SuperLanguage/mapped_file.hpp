@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+// Whole file mapped into memory. Pages are loaded by the OS on first
+// access, so opening does not depend on the file size. Writable mappings
+// write changes back to the file, at the latest on close.
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile();
+
+	// Failures are logged and leave the file closed
+	bool open(const char* path);
+
+	// Maps the file for reading and writing. A missing file is created, a
+	// file smaller than min_size is extended with zeros.
+	bool open_writable(const char* path, size_t min_size);
+
+	// Writes changed pages of a writable mapping to the file
+	bool flush();
+
+	void close();
+
+	bool is_open() const { return _open; }
+
+	std::string_view get_content() const { return { _data, _size }; }
+
+	// Null unless the mapping is writable
+	char* get_writable_data() const { return _writable ? _data : nullptr; }
+
+private:
+	char* _data = nullptr;
+	size_t _size = 0;
+	bool _open = false;
+	bool _writable = false;
+#ifdef _WIN32
+	void* _file = nullptr;
+	void* _mapping = nullptr;
+#endif
+};
@@ -0,0 +1,254 @@
+#pragma once
+
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "interpreter.hpp"
+#include "stats.hpp"
+
+// Typed binding of C++ callables as script functions. The signature of the
+// callable decides how arguments are read from the interpreter stack and
+// how the result is returned, e.g.
+//
+//	register_native(program, "__get_array_size", [](ArrayObj* arr) { return static_cast<int>(arr->size()); });
+//
+// Supported parameters are int, float, bool, std::string, std::string_view,
+// ObjectPtr, String*, ArrayObj*, MapObj*, FileObj*, IteratorObj*, TaskObj*, ChannelObj*, or a single std::span<const ObjectPtr> for
+// variadic functions. An Interpreter* first parameter is passed through.
+namespace native_details
+{
+	template <class T>
+	struct Arg;
+
+	template <>
+	struct Arg<int>
+	{
+		static bool load(const ObjectPtr& obj, int& out) { return obj->get(&out); }
+	};
+
+	template <>
+	struct Arg<float>
+	{
+		static bool load(const ObjectPtr& obj, float& out)
+		{
+			int ival;
+			if (obj->get(&ival))
+			{
+				out = static_cast<float>(ival);
+				return true;
+			}
+			return obj->get(&out);
+		}
+	};
+
+	template <>
+	struct Arg<bool>
+	{
+		static bool load(const ObjectPtr& obj, bool& out) { return obj->get(&out); }
+	};
+
+	template <>
+	struct Arg<std::string>
+	{
+		static bool load(const ObjectPtr& obj, std::string& out) { return obj->get(&out); }
+	};
+
+	// Valid while the argument stays on the stack, i.e. for the whole call
+	template <>
+	struct Arg<std::string_view>
+	{
+		static bool load(const ObjectPtr& obj, std::string_view& out) { return obj->get(&out); }
+	};
+
+	template <>
+	struct Arg<ObjectPtr>
+	{
+		static bool load(const ObjectPtr& obj, ObjectPtr& out) { out = obj; return true; }
+	};
+
+	template <>
+	struct Arg<ArrayObj*>
+	{
+		static bool load(const ObjectPtr& obj, ArrayObj*& out) { return obj->get(&out); }
+	};
+
+	template <>
+	struct Arg<MapObj*>
+	{
+		static bool load(const ObjectPtr& obj, MapObj*& out) { return obj->get(&out); }
+	};
+
+	template <>
+	struct Arg<String*>
+	{
+		static bool load(const ObjectPtr& obj, String*& out) { return obj->get(&out); }
+	};
+
+	template <>
+	struct Arg<FileObj*>
+	{
+		static bool load(const ObjectPtr& obj, FileObj*& out) { return obj->get(&out); }
+	};
+
+	template <>
+	struct Arg<IteratorObj*>
+	{
+		static bool load(const ObjectPtr& obj, IteratorObj*& out) { return obj->get(&out); }
+	};
+
+	template <>
+	struct Arg<TaskObj*>
+	{
+		static bool load(const ObjectPtr& obj, TaskObj*& out) { return obj->get(&out); }
+	};
+
+	template <>
+	struct Arg<ChannelObj*>
+	{
+		static bool load(const ObjectPtr& obj, ChannelObj*& out) { return obj->get(&out); }
+	};
+
+	inline ObjectPtr to_object(int v) { return Integer::make(v); }
+	inline ObjectPtr to_object(float v) { return make_object<Float>(v); }
+	inline ObjectPtr to_object(bool v) { return Bool::make(v); }
+	inline ObjectPtr to_object(std::string&& v) { return make_object<String>(std::move(v)); }
+	inline ObjectPtr to_object(ObjectPtr&& v) { return std::move(v); }
+
+	template <class T>
+	ObjectPtr to_object(Ref<T>&& v) { return std::move(v); }
+
+	template <class F>
+	struct Signature : Signature<decltype(&F::operator())> {};
+
+	template <class C, class R, class... A>
+	struct Signature<R(C::*)(A...) const>
+	{
+		using Return = R;
+		using Args = std::tuple<std::decay_t<A>...>;
+	};
+
+	template <class R, class... A>
+	struct Signature<R(*)(A...)>
+	{
+		using Return = R;
+		using Args = std::tuple<std::decay_t<A>...>;
+	};
+
+	template <class Tuple>
+	struct Params
+	{
+		using Types = Tuple;
+		static constexpr bool with_interpreter = false;
+	};
+
+	template <class... A>
+	struct Params<std::tuple<Interpreter*, A...>>
+	{
+		using Types = std::tuple<A...>;
+		static constexpr bool with_interpreter = true;
+	};
+
+	template <class Tuple>
+	constexpr bool is_variadic = false;
+
+	template <>
+	constexpr bool is_variadic<std::tuple<std::span<const ObjectPtr>>> = true;
+}
+
+template <class F>
+class NativeFunction final : public Function
+{
+	using Sig = native_details::Signature<F>;
+	using Params = native_details::Params<typename Sig::Args>;
+	using Types = typename Params::Types;
+
+	static constexpr bool variadic = native_details::is_variadic<Types>;
+	static constexpr size_t arity = std::tuple_size_v<Types>;
+
+public:
+	NativeFunction(std::string&& name, F func)
+		:Function(nullptr, std::move(name), variadic ? -1 : static_cast<int>(arity))
+		,_func(std::move(func))
+	{}
+
+	bool is_native() const override { return true; }
+
+	void run(Interpreter* interp, size_t stack_base) override
+	{
+		STATS_COUNT(stats::Counter::NativeCall);
+		const auto args = interp->get_stack_slice(stack_base);
+
+		if constexpr (variadic)
+		{
+			invoke(interp, Types{ args });
+		}
+		else
+		{
+			if (args.size() != arity)
+			{
+				LOG_ERROR("Function {} expects {} arguments, {} given", get_name(), arity, args.size());
+				return;
+			}
+
+			Types values;
+			if (load_args(args, values, std::make_index_sequence<arity>{}))
+			{
+				invoke(interp, std::move(values));
+			}
+		}
+	}
+
+private:
+	template <size_t... I>
+	bool load_args([[maybe_unused]] std::span<const ObjectPtr> args, [[maybe_unused]] Types& values, std::index_sequence<I...>) const
+	{
+		size_t failed = arity;
+		const bool loaded = (... && (native_details::Arg<std::tuple_element_t<I, Types>>::load(args[I], std::get<I>(values)) || ((failed = I), false)));
+		if (!loaded)
+		{
+			LOG_ERROR("Function {}: unexpected type of argument {}", get_name(), failed);
+		}
+		return loaded;
+	}
+
+	void invoke(Interpreter* interp, Types&& values)
+	{
+		auto call = [this, interp](auto&&... args) -> decltype(auto)
+		{
+			if constexpr (Params::with_interpreter)
+			{
+				return _func(interp, std::forward<decltype(args)>(args)...);
+			}
+			else
+			{
+				return _func(std::forward<decltype(args)>(args)...);
+			}
+		};
+
+		using Return = typename Sig::Return;
+		if constexpr (std::is_void_v<Return>)
+		{
+			std::apply(call, std::move(values));
+		}
+		else
+		{
+			if (auto result = native_details::to_object(std::apply(call, std::move(values))))
+			{
+				interp->set_return_value(std::move(result));
+			}
+		}
+	}
+
+	F _func;
+};
+
+template <class F>
+void register_native(Program& program, std::string name, F func)
+{
+	program.add_function(std::make_unique<NativeFunction<F>>(std::move(name), std::move(func)));
+}
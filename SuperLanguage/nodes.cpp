@@ -1,6 +1,7 @@
 #include "nodes.hpp"
 
 #include "interpreter.hpp"
+#include "stats.hpp"
 
 void BinaryOperation::accept(NodeVisitor& visitor)
 {
@@ -20,54 +21,11 @@ Scope::~Scope()
 	}
 }
 
-void Scope::reset()
-{
-	_base_index = 0;
-	_variable_count = 0;
-}
-
 void Scope::accept(NodeVisitor& visitor)
 {
 	visitor.visit(this);
 }
 
-void Scope::add_variable()
-{
-	++_variable_count;
-}
-
-size_t Scope::get_variable_count() const
-{
-	return _variable_count;
-}
-
-size_t Scope::apply_index_offset(size_t index) const
-{
-	return _base_index + index;
-}
-
-void Scope::set_variable_count(size_t var_count)
-{
-	_variable_count = var_count;
-}
-
-std::vector<size_t> Scope::get_variables() const
-{
-	std::vector<size_t> res;
-	auto from = _base_index;
-	const auto end = _base_index + _variable_count;
-	while(from < end)
-	{
-		res.push_back(from++);
-	}
-	return res;
-}
-
-void Scope::set_stack_base(size_t base)
-{
-	_base_index = base;
-}
-
 void Assign::accept(NodeVisitor& visitor)
 {
 	visitor.visit(this);
@@ -83,6 +41,11 @@ void Call::accept(NodeVisitor& visitor)
 	visitor.visit(this);
 }
 
+void Spawn::accept(NodeVisitor& visitor)
+{
+	visitor.visit(this);
+}
+
 void StackValue::accept(NodeVisitor& visitor)
 {
 	visitor.visit(this);
@@ -105,7 +68,6 @@ void Function::run(Interpreter* interp, size_t stack_base)
 {
 	if(_scope)
 	{
-		_scope->set_stack_base(stack_base);
 		NodeVisitor* visitor = interp;
 		visitor->visit(_scope);
 	}
@@ -119,12 +81,9 @@ InternalFunction::InternalFunction(std::string&& name, Func f)
 
 void InternalFunction::run(Interpreter* interp, size_t stack_base)
 {
-	if(const auto scope = get_scope())
-	{
-		scope->set_stack_base(stack_base);
-	}
 	if(_func)
 	{
+		STATS_COUNT(stats::Counter::NativeCall);
 		_func(interp, get_scope());
 	}
 }
@@ -149,6 +108,11 @@ Node* Return::get_expression() const
 	return _expression;
 }
 
+void Yield::accept(NodeVisitor& visitor)
+{
+	visitor.visit(this);
+}
+
 BranchIfElse::BranchIfElse(Node* expression, Scope* scope, Scope* else_scope)
 	:_expression(expression)
 	,_scope(scope)
@@ -192,6 +156,24 @@ Node* Loop::get_expression() const
 	return _expression;
 }
 
+ForRange::ForRange(size_t var_index, Node* begin, Node* end, Scope* scope)
+	:_var_index(var_index)
+	,_begin(begin)
+	,_end(end)
+	,_scope(scope)
+{}
+
+void ForRange::accept(NodeVisitor& visitor)
+{
+	visitor.visit(this);
+}
+
+void ForRange::set_parallel(std::vector<size_t> written_arrays)
+{
+	_parallel = true;
+	_written_arrays = std::move(written_arrays);
+}
+
 ArrayNode::ArrayNode(std::vector<Node*> array_nodes)
 	:_array_nodes(std::move(array_nodes))
 {
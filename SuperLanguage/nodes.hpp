@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <functional>
 #include <vector>
 #include <string>
@@ -17,6 +18,21 @@ public:
 	virtual ~Node() = default;
 
 	virtual void accept(NodeVisitor& visitor) = 0;
+
+	// Source line and column of the token the node was parsed from, 0 when unknown
+	int get_line() const { return _line; }
+
+	int get_pos() const { return _pos; }
+
+	void set_position(int line, int pos)
+	{
+		_line = line;
+		_pos = pos;
+	}
+
+private:
+	int _line = 0;
+	int _pos = 0;
 };
 
 enum class Operation
@@ -63,29 +79,11 @@ public:
 
 	~Scope() override;
 
-	void reset();
-
 	void accept(NodeVisitor& visitor) override;
 
 	const std::vector<Node*>& get_nodes() const { return _nodes; }
 
-	size_t get_stack_base() const { return _base_index; }
-
-	void add_variable();
-
-	size_t get_variable_count() const;
-
-	size_t apply_index_offset(size_t index) const;
-
-	void set_variable_count(size_t var_count);
-
-	std::vector<size_t> get_variables() const;
-
-	void set_stack_base(size_t base);
-
 private:
-	size_t _base_index = 0;
-	size_t _variable_count = 0;
 	std::vector<Node*> _nodes;
 };
 
@@ -169,12 +167,21 @@ public:
 
 	Scope* get_scope() const { return _scope; }
 
+	// Functions containing yield return a generator instead of running
+	bool is_generator() const { return _generator; }
+
+	void set_generator(bool generator) { _generator = generator; }
+
+	// Implemented in C++ rather than script
+	virtual bool is_native() const { return false; }
+
 	virtual void run(Interpreter* interp, size_t stack_base);
 
 private:
 	Scope* _scope;
 	std::string _name;
 	int _param_count;
+	bool _generator = false;
 };
 
 class InternalFunction : public Function
@@ -184,6 +191,8 @@ public:
 
 	InternalFunction(std::string&& name, Func f);
 
+	bool is_native() const override { return true; }
+
 	void run(Interpreter* interp, size_t stack_base) override;
 
 	void accept(NodeVisitor& visitor) override;
@@ -216,12 +225,41 @@ public:
 		return _args;
 	}
 
+	// Statement calls drop their return value instead of leaving it on the stack
+	bool is_statement() const { return _statement; }
+
+	void set_statement(bool statement) { _statement = statement; }
+
+	// Named functions are looked up once, later calls reuse the result. Worker
+	// interpreters resolve to the same functions, so relaxed access is enough.
+	Function* get_resolved_function() const { return _resolved_function.load(std::memory_order_relaxed); }
+
+	void set_resolved_function(Function* func) { _resolved_function.store(func, std::memory_order_relaxed); }
+
 private:
 	std::vector<Node*> _args;
 	std::string _function_name;
 	size_t _var_index = 0;
+	bool _statement = false;
+	std::atomic<Function*> _resolved_function = nullptr;
 };
 
+// spawn f(args): starts the call as a task and evaluates to the task handle.
+// A spawn statement drops the handle, its call is marked a statement.
+class Spawn : public Node
+{
+public:
+	explicit Spawn(Call* call)
+		:_call(call)
+	{}
+
+	void accept(NodeVisitor& visitor) override;
+
+	Call* get_call() const { return _call; }
+
+private:
+	Call* _call;
+};
 
 class Return : public Node
 {
@@ -236,6 +274,23 @@ private:
 	Node* _expression;
 };
 
+// yield expr: hands the value to the generator consumer and suspends the
+// function until the next value is requested
+class Yield : public Node
+{
+public:
+	explicit Yield(Node* expression)
+		:_expression(expression)
+	{}
+
+	void accept(NodeVisitor& visitor) override;
+
+	Node* get_expression() const { return _expression; }
+
+private:
+	Node* _expression;
+};
+
 class BranchIfElse : public Node
 {
 public:
@@ -245,6 +300,10 @@ public:
 
 	Node* get_expression() const;
 
+	Scope* get_scope() const { return _scope; }
+
+	Scope* get_else_scope() const { return _else_scope; }
+
 	void execute(NodeVisitor& visitor, bool main_branch);
 
 private:
@@ -269,6 +328,41 @@ private:
 	Scope* _scope;
 };
 
+// for i in begin..end: runs the scope for every integer from begin up to
+// end, exclusive. Bounds are evaluated once. A parallel loop splits the
+// range over the thread pool if the parser found its body free of writes
+// to outer variables, otherwise it runs like a plain one.
+class ForRange : public Node
+{
+public:
+	ForRange(size_t var_index, Node* begin, Node* end, Scope* scope);
+
+	void accept(NodeVisitor& visitor) override;
+
+	size_t get_var_index() const { return _var_index; }
+
+	Node* get_begin() const { return _begin; }
+
+	Node* get_end() const { return _end; }
+
+	Scope* get_scope() const { return _scope; }
+
+	bool is_parallel() const { return _parallel; }
+
+	// Outer arrays the body sets elements of, by stack index
+	const std::vector<size_t>& get_written_arrays() const { return _written_arrays; }
+
+	void set_parallel(std::vector<size_t> written_arrays);
+
+private:
+	size_t _var_index;
+	Node* _begin;
+	Node* _end;
+	Scope* _scope;
+	bool _parallel = false;
+	std::vector<size_t> _written_arrays;
+};
+
 class ArrayNode : public Node
 {
 public:
@@ -296,9 +390,12 @@ public:
 	virtual void visit(Function* node) = 0;
 	virtual void visit(InternalFunction* node) = 0;
 	virtual void visit(Call* node) = 0;
+	virtual void visit(Spawn* node) = 0;
 	virtual void visit(Return* node) = 0;
+	virtual void visit(Yield* node) = 0;
 	virtual void visit(BranchIfElse* node) = 0;
 	virtual void visit(Loop* node) = 0;
+	virtual void visit(ForRange* node) = 0;
  };
 
 
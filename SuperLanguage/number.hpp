@@ -1,7 +1,7 @@
 #pragma once
 #include <optional>
 
-#include "lexer.hpp"
+#include "object.hpp"
 
 
 
@@ -28,12 +28,18 @@ public:
 	{
 		if(_is_int)
 		{
-			return std::make_shared<Integer>(_value.i_num);
+			return Integer::make(_value.i_num);
 		}
 
-		return std::make_shared<Float>(_value.f_num);
+		return make_object<Float>(_value.f_num);
 	}
 
+	bool is_int() const { return _is_int; }
+
+	int as_int() const { return _is_int ? _value.i_num : static_cast<int>(_value.f_num); }
+
+	float as_float() const { return _is_int ? static_cast<float>(_value.i_num) : _value.f_num; }
+
 	Number()
 		:_value{ .i_num = 0 }
 		, _is_int(true)
@@ -1,5 +1,129 @@
 #include "object.hpp"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+#include "log.hpp"
+
+namespace
+{
+	thread_local size_t cached_integer_hits = 0;
+}
+
+namespace pool_details
+{
+	void* allocate_chunk(size_t size)
+	{
+		static std::mutex mutex;
+		static std::vector<std::unique_ptr<std::byte[]>> chunks;
+
+		std::lock_guard lock{ mutex };
+		return chunks.emplace_back(std::make_unique<std::byte[]>(size)).get();
+	}
+}
+
+AllocationStats get_allocation_stats()
+{
+	return AllocationStats{
+		ObjectPool<Integer>::get_stats(),
+		ObjectPool<Float>::get_stats(),
+		ObjectPool<Bool>::get_stats(),
+		ObjectPool<String>::get_stats(),
+		cached_integer_hits
+	};
+}
+
+void Object::add_ref_shared() const
+{
+	std::atomic_ref<uint32_t>(_ref_count).fetch_add(1, std::memory_order_relaxed);
+}
+
+void Object::release_shared() const
+{
+	if (std::atomic_ref<uint32_t>(_ref_count).fetch_sub(1, std::memory_order_acq_rel) == 1 && !_managed)
+	{
+		delete this;
+	}
+}
+
+Ref<Integer> Integer::make(int v)
+{
+	if (v < min_cached || v > max_cached)
+	{
+		return make_object<Integer>(v);
+	}
+
+	static thread_local const auto cache = []
+	{
+		auto values = std::make_unique<std::array<Ref<Integer>, max_cached - min_cached + 1>>();
+		for (int i = min_cached; i <= max_cached; ++i)
+		{
+			(*values)[i - min_cached] = Ref<Integer>(new Integer(i));
+		}
+		return values;
+	}();
+
+	++cached_integer_hits;
+	return (*cache)[v - min_cached];
+}
+
+Ref<Bool> Bool::make(bool v)
+{
+	static thread_local const Ref<Bool> true_value{ new Bool(true) };
+	static thread_local const Ref<Bool> false_value{ new Bool(false) };
+
+	return v ? true_value : false_value;
+}
+
+void String::mark_shared()
+{
+	if (is_shared())
+	{
+		return;
+	}
+
+	Object::mark_shared();
+	if (_owner)
+	{
+		_owner->mark_shared();
+	}
+}
+
+void String::trace(Tracer& tracer)
+{
+	tracer.visit(_owner.get());
+}
+
+void String::clear_references()
+{
+	_owner.reset();
+	_view = {};
+}
+
+Ref<String> String::slice(size_t pos, size_t count)
+{
+	pos = std::min(pos, _view.size());
+	// Slices of slices point straight at the owner
+	Ref<String> owner = _owner ? _owner : Ref<String>{ this };
+	return make_object<String>(std::move(owner), _view.substr(pos, count));
+}
+
+size_t String::get_hash() const
+{
+	auto hash = _hash.load(std::memory_order_acquire);
+	if (hash == 0)
+	{
+		// Threads racing here compute the same value
+		hash = std::max<size_t>(std::hash<std::string_view>{}(_view), 1);
+		_hash.store(hash, std::memory_order_release);
+	}
+	return hash;
+}
 
 bool Callable::get(Scope** val) const
 {
@@ -8,3 +132,573 @@ bool Callable::get(Scope** val) const
 }
 
 
+ArrayObj::ArrayObj(std::vector<ObjectPtr> objects)
+{
+	for(auto& obj : objects)
+	{
+		if(_type != ElementType::Generic && try_append_packed(obj))
+		{
+			continue;
+		}
+
+		make_generic();
+		_objects.emplace_back(std::move(obj));
+	}
+}
+
+void ArrayObj::mark_shared()
+{
+	if (is_shared())
+	{
+		return;
+	}
+
+	Object::mark_shared();
+	for (const auto& obj : _objects)
+	{
+		obj->mark_shared();
+	}
+}
+
+void ArrayObj::trace(Tracer& tracer)
+{
+	for (const auto& obj : _objects)
+	{
+		tracer.visit(obj.get());
+	}
+}
+
+void ArrayObj::clear_references()
+{
+	_objects = {};
+}
+
+size_t ArrayObj::size() const
+{
+	switch (_type)
+	{
+	case ElementType::Int:		return get_ints().size();
+	case ElementType::Float:	return get_floats().size();
+	case ElementType::Bool:		return get_bools().size();
+	default:					return _objects.size();
+	}
+}
+
+ObjectPtr ArrayObj::get_element(size_t index) const
+{
+	if(index >= size())
+	{
+		return {};
+	}
+
+	switch (_type)
+	{
+	case ElementType::Int:		return Integer::make(get_ints()[index]);
+	case ElementType::Float:	return make_object<Float>(get_floats()[index]);
+	case ElementType::Bool:		return Bool::make(get_bools()[index] != 0);
+	default:					return _objects[index];
+	}
+}
+
+bool ArrayObj::set_element(size_t index, ObjectPtr obj)
+{
+	if(index >= size() || !obj)
+	{
+		return false;
+	}
+
+	if(!try_store_packed(index, obj))
+	{
+		if (is_fixed())
+		{
+			LOG_ERROR("Value doesn't match the element type of a mapped array");
+			return false;
+		}
+		if (_layout_locked && _type != ElementType::Generic)
+		{
+			LOG_ERROR("Value doesn't match the element type of an array set by a parallel loop");
+			return false;
+		}
+		make_generic();
+		if (is_shared())
+		{
+			obj->mark_shared();
+		}
+		_objects[index] = std::move(obj);
+	}
+	return true;
+}
+
+void ArrayObj::append(ObjectPtr obj)
+{
+	if (!obj)
+	{
+		return;
+	}
+
+	if (is_fixed())
+	{
+		LOG_ERROR("Mapped arrays have a fixed size");
+		return;
+	}
+
+	detach();
+	if(_type == ElementType::Generic || !try_append_packed(obj))
+	{
+		make_generic();
+		if (is_shared())
+		{
+			obj->mark_shared();
+		}
+		_objects.emplace_back(std::move(obj));
+	}
+}
+
+void ArrayObj::set_layout_locked(bool locked)
+{
+	// Writable external storage is changed in place anyway
+	if (locked && !is_fixed())
+	{
+		detach();
+	}
+	_layout_locked = locked;
+}
+
+void ArrayObj::assign(size_t count, const ObjectPtr& value)
+{
+	_external = {};
+	_objects = {};
+	_ints = {};
+	_floats = {};
+	_bools = {};
+	_type = get_object_type(value);
+
+	switch (_type)
+	{
+	case ElementType::Int:		_ints.assign(count, *value->get_inner<int>());			break;
+	case ElementType::Float:	_floats.assign(count, *value->get_inner<float>());		break;
+	case ElementType::Bool:		_bools.assign(count, *value->get_inner<bool>());		break;
+	default:					_objects.assign(count, value);							break;
+	}
+}
+
+void ArrayObj::fill(const ObjectPtr& value)
+{
+	switch (_type)
+	{
+	case ElementType::Int:
+		if (const auto val = value->get_inner<int>())
+		{
+			std::ranges::fill(edit_ints(), *val);
+			return;
+		}
+		break;
+	case ElementType::Float:
+		if (const auto val = value->get_inner<float>())
+		{
+			std::ranges::fill(edit_floats(), *val);
+			return;
+		}
+		break;
+	case ElementType::Bool:
+		if (const auto val = value->get_inner<bool>())
+		{
+			std::ranges::fill(edit_bools(), static_cast<uint8_t>(*val));
+			return;
+		}
+		break;
+	default:
+		break;
+	}
+
+	if (is_fixed())
+	{
+		LOG_ERROR("Value doesn't match the element type of a mapped array");
+		return;
+	}
+	assign(size(), value);
+}
+
+void ArrayObj::clear()
+{
+	_external = {};
+	_objects = {};
+	_ints = {};
+	_floats = {};
+	_bools = {};
+	_type = ElementType::Empty;
+}
+
+void ArrayObj::assign(std::vector<int>&& values)
+{
+	_external = {};
+	_objects = {};
+	_floats = {};
+	_bools = {};
+	_ints = std::move(values);
+	_type = ElementType::Int;
+}
+
+void ArrayObj::assign(std::vector<float>&& values)
+{
+	_external = {};
+	_objects = {};
+	_ints = {};
+	_bools = {};
+	_floats = std::move(values);
+	_type = ElementType::Float;
+}
+
+bool ArrayObj::promote_to_floats()
+{
+	if (_type == ElementType::Int)
+	{
+		if (is_fixed())
+		{
+			LOG_ERROR("Mapped int arrays can't hold floats");
+			return false;
+		}
+
+		const auto ints = get_ints();
+		_floats.assign(ints.begin(), ints.end());
+		_ints = {};
+		_external = {};
+		_type = ElementType::Float;
+	}
+	return true;
+}
+
+void ArrayObj::assign_external(ElementType type, std::shared_ptr<const void> owner, void* data, size_t count, bool writable)
+{
+	_objects = {};
+	_ints = {};
+	_floats = {};
+	_bools = {};
+	_type = type;
+	_external = { std::move(owner), data, count, writable };
+}
+
+void ArrayObj::truncate(size_t count)
+{
+	if (count >= size())
+	{
+		return;
+	}
+	if (is_fixed())
+	{
+		LOG_ERROR("Mapped arrays have a fixed size");
+		return;
+	}
+
+	detach();
+	switch (_type)
+	{
+	case ElementType::Int:		_ints.resize(count);		break;
+	case ElementType::Float:	_floats.resize(count);		break;
+	case ElementType::Bool:		_bools.resize(count);		break;
+	default:					_objects.resize(count);		break;
+	}
+}
+
+void ArrayObj::detach()
+{
+	if (!_external.data)
+	{
+		return;
+	}
+
+	switch (_type)
+	{
+	case ElementType::Int:		_ints.assign(get_ints().begin(), get_ints().end());			break;
+	case ElementType::Float:	_floats.assign(get_floats().begin(), get_floats().end());	break;
+	case ElementType::Bool:		_bools.assign(get_bools().begin(), get_bools().end());		break;
+	default:					break;
+	}
+	_external = {};
+}
+
+ArrayObj::ElementType ArrayObj::get_object_type(const ObjectPtr& obj)
+{
+	if(obj->get_inner<int>())
+	{
+		return ElementType::Int;
+	}
+	if(obj->get_inner<float>())
+	{
+		return ElementType::Float;
+	}
+	if(obj->get_inner<bool>())
+	{
+		return ElementType::Bool;
+	}
+	return ElementType::Generic;
+}
+
+bool ArrayObj::try_store_packed(size_t index, const ObjectPtr& obj)
+{
+	switch (_type)
+	{
+	case ElementType::Int:
+		{
+			int val;
+			if(obj->get(&val))
+			{
+				edit_ints()[index] = val;
+				return true;
+			}
+			return false;
+		}
+	case ElementType::Float:
+		{
+			float val;
+			if(obj->get(&val))
+			{
+				edit_floats()[index] = val;
+				return true;
+			}
+			return false;
+		}
+	case ElementType::Bool:
+		{
+			bool val;
+			if(obj->get(&val))
+			{
+				edit_bools()[index] = val;
+				return true;
+			}
+			return false;
+		}
+	default:
+		return false;
+	}
+}
+
+bool ArrayObj::try_append_packed(const ObjectPtr& obj)
+{
+	if(_type == ElementType::Empty)
+	{
+		_type = get_object_type(obj);
+	}
+
+	switch (_type)
+	{
+	case ElementType::Int:
+		if (const auto val = obj->get_inner<int>())
+		{
+			_ints.push_back(*val);
+			return true;
+		}
+		return false;
+	case ElementType::Float:
+		if (const auto val = obj->get_inner<float>())
+		{
+			_floats.push_back(*val);
+			return true;
+		}
+		return false;
+	case ElementType::Bool:
+		if (const auto val = obj->get_inner<bool>())
+		{
+			_bools.push_back(*val);
+			return true;
+		}
+		return false;
+	default:
+		return false;
+	}
+}
+
+void ArrayObj::make_generic()
+{
+	if(_type == ElementType::Generic)
+	{
+		return;
+	}
+
+	const auto count = size();
+	_objects.reserve(count);
+	for(size_t i = 0; i < count; ++i)
+	{
+		_objects.emplace_back(get_element(i));
+	}
+
+	_ints = {};
+	_floats = {};
+	_bools = {};
+	_external = {};
+	_type = ElementType::Generic;
+}
+
+void MapObj::mark_shared()
+{
+	if (is_shared())
+	{
+		return;
+	}
+
+	Object::mark_shared();
+	for (const auto& slot : _slots)
+	{
+		if (slot.key)
+		{
+			slot.key->mark_shared();
+			slot.value->mark_shared();
+		}
+	}
+}
+
+void MapObj::trace(Tracer& tracer)
+{
+	for (const auto& slot : _slots)
+	{
+		if (slot.key)
+		{
+			tracer.visit(slot.key.get());
+			tracer.visit(slot.value.get());
+		}
+	}
+}
+
+void MapObj::clear_references()
+{
+	_slots = {};
+	_size = 0;
+}
+
+ObjectPtr MapObj::find(const ObjectPtr& key) const
+{
+	if (const auto slot = find_slot(*key, hash_key(*key)); slot && slot->key)
+	{
+		return slot->value;
+	}
+	return {};
+}
+
+bool MapObj::contains(const ObjectPtr& key) const
+{
+	const auto slot = find_slot(*key, hash_key(*key));
+	return slot && slot->key;
+}
+
+void MapObj::insert(ObjectPtr key, ObjectPtr value)
+{
+	if ((_size + 1) * 4 > _slots.size() * 3)
+	{
+		grow();
+	}
+
+	if (is_shared())
+	{
+		key->mark_shared();
+		if (value)
+		{
+			value->mark_shared();
+		}
+	}
+
+	const auto hash = hash_key(*key);
+	auto slot = const_cast<Slot*>(find_slot(*key, hash));
+	if (!slot->key)
+	{
+		slot->hash = hash;
+		slot->key = std::move(key);
+		++_size;
+	}
+	slot->value = std::move(value);
+}
+
+size_t MapObj::hash_key(const Object& key)
+{
+	auto mix = [](uint64_t x)
+	{
+		x ^= x >> 33;
+		x *= 0xff51afd7ed558ccdull;
+		x ^= x >> 33;
+		return static_cast<size_t>(x);
+	};
+
+	if (const auto str = dynamic_cast<const String*>(&key))
+	{
+		return str->get_hash();
+	}
+	if (const auto ival = key.get_inner<int>())
+	{
+		return mix(static_cast<uint32_t>(*ival));
+	}
+	if (const auto fval = key.get_inner<float>())
+	{
+		return mix(std::bit_cast<uint32_t>(*fval == 0.f ? 0.f : *fval) ^ 0x9e3779b9u);
+	}
+	if (const auto bval = key.get_inner<bool>())
+	{
+		return mix(*bval ? 0x5bd1e995u : 0x1b873593u);
+	}
+	return mix(reinterpret_cast<uintptr_t>(&key));
+}
+
+bool MapObj::keys_equal(const Object& left, const Object& right)
+{
+	if (&left == &right)
+	{
+		return true;
+	}
+
+	std::string_view lstr, rstr;
+	if (left.get(&lstr))
+	{
+		return right.get(&rstr) && lstr == rstr;
+	}
+	if (const auto ival = left.get_inner<int>())
+	{
+		return ival == right.get_inner<int>();
+	}
+	if (const auto fval = left.get_inner<float>())
+	{
+		return fval == right.get_inner<float>();
+	}
+	if (const auto bval = left.get_inner<bool>())
+	{
+		return bval == right.get_inner<bool>();
+	}
+	return false;
+}
+
+const MapObj::Slot* MapObj::find_slot(const Object& key, size_t hash) const
+{
+	if (_slots.empty())
+	{
+		return nullptr;
+	}
+
+	const auto mask = _slots.size() - 1;
+	for (auto index = hash & mask;; index = (index + 1) & mask)
+	{
+		const auto& slot = _slots[index];
+		if (!slot.key || (slot.hash == hash && keys_equal(*slot.key, key)))
+		{
+			return &slot;
+		}
+	}
+}
+
+void MapObj::grow()
+{
+	auto old_slots = std::move(_slots);
+	_slots = std::vector<Slot>(old_slots.empty() ? 16 : old_slots.size() * 2);
+
+	const auto mask = _slots.size() - 1;
+	for (auto& old_slot : old_slots)
+	{
+		if (!old_slot.key)
+		{
+			continue;
+		}
+
+		auto index = old_slot.hash & mask;
+		while (_slots[index].key)
+		{
+			index = (index + 1) & mask;
+		}
+		_slots[index] = std::move(old_slot);
+	}
+}
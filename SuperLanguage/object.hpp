@@ -1,29 +1,151 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <memory>
+#include <new>
 #include <optional>
+#include <span>
 #include <string>
+#include <string_view>
 #include <vector>
 
+#include "pool.hpp"
+#include "ref.hpp"
+#include "stats.hpp"
+
 class Node;
 class Scope;
 class Function;
+class Interpreter;
 class Object;
-using ObjectPtr = std::shared_ptr<Object>;
+class ArrayObj;
+class Heap;
+class MapObj;
+class String;
+class FileObj;
+class IteratorObj;
+class TaskObj;
+class ChannelObj;
+using ObjectPtr = Ref<Object>;
+
+namespace gc
+{
+	// Heap of the running interpreter, null when objects are refcounted only
+	extern thread_local Heap* current_heap;
+
+	void* allocate(Heap* heap, size_t size);
+
+	void track(Heap* heap, Object* obj);
+}
+
+template <class T, class... Args>
+Ref<T> make_object(Args&&... args)
+{
+	STATS_ALLOCATION(T);
+	if (Heap* heap = gc::current_heap)
+	{
+		T* obj = ::new (gc::allocate(heap, sizeof(T))) T(std::forward<Args>(args)...);
+		gc::track(heap, obj);
+		return Ref<T>(obj);
+	}
+	return Ref<T>(new T(std::forward<Args>(args)...));
+}
+
+struct AllocationStats
+{
+	PoolStats integers;
+	PoolStats floats;
+	PoolStats bools;
+	PoolStats strings;
+	size_t cached_integers = 0;
+};
+
+// Counters of the calling thread
+AllocationStats get_allocation_stats();
+
+// Visits the objects referenced by another object, used by the collector
+class Tracer
+{
+public:
+	virtual ~Tracer() = default;
+
+	virtual void visit(Object* obj) = 0;
+};
 
-class Object : public std::enable_shared_from_this<Object>
+class Object
 {
 public:
+	Object() = default;
+	Object(const Object&) = delete;
+	Object& operator=(const Object&) = delete;
 	virtual ~Object() = default;
 
+	// Interpreter objects belong to a single thread and are counted with
+	// plain increments. Objects handed to another thread have to be marked
+	// shared first, after that their counter is updated atomically.
+	void add_ref() const
+	{
+		if (!_shared)
+		{
+			++_ref_count;
+			return;
+		}
+		add_ref_shared();
+	}
+
+	void release() const
+	{
+		if (!_shared)
+		{
+			if (--_ref_count == 0 && !_managed)
+			{
+				delete this;
+			}
+			return;
+		}
+		release_shared();
+	}
+
+	// Already shared objects are left untouched, other threads may be reading the flag
+	virtual void mark_shared()
+	{
+		if (!_shared)
+		{
+			_shared = true;
+		}
+	}
+
+	bool is_shared() const { return _shared; }
+
+	// Other threads may update the count of shared objects meanwhile
+	uint32_t get_ref_count() const
+	{
+		return _shared ? std::atomic_ref<uint32_t>(_ref_count).load(std::memory_order_relaxed) : _ref_count;
+	}
+
+	// Heap objects are not deleted at zero references, the collector owns them
+	bool is_managed() const { return _managed; }
+
+	virtual void trace(Tracer& tracer) {}
+
+	// Drops references to other objects before the collector destroys a cycle
+	virtual void clear_references() {}
 
 	virtual bool get(int* val) const { return false; }
 	virtual bool get(float* val) const { return false; }
 	virtual bool get(bool* val) const { return false; }
 	virtual bool get(std::string* val) const { return false; }
+	virtual bool get(std::string_view* val) const { return false; }
 	virtual bool get(Scope** val) const { return false; }
 	virtual bool get(Function** val) const { return false; }
-	virtual bool get(std::vector<ObjectPtr>** val) { return false; }
+	virtual bool get(ArrayObj** val) { return false; }
+	virtual bool get(MapObj** val) { return false; }
+	virtual bool get(String** val) { return false; }
+	virtual bool get(FileObj** val) { return false; }
+	virtual bool get(IteratorObj** val) { return false; }
+	virtual bool get(TaskObj** val) { return false; }
+	virtual bool get(ChannelObj** val) { return false; }
 
 	template <class T>
 	std::optional<T> get_inner() const
@@ -35,6 +157,17 @@ public:
 		}
 		return {};
 	}
+
+private:
+	void add_ref_shared() const;
+
+	void release_shared() const;
+
+	friend class Heap;
+
+	mutable uint32_t _ref_count = 0;
+	bool _shared = false;
+	bool _managed = false;
 };
 
 
@@ -42,10 +175,18 @@ public:
 class Integer : public Object
 {
 public:
+	static constexpr int min_cached = -256;
+	static constexpr int max_cached = 1024;
+
+	DECLARE_POOLED_OBJECT(Integer)
+
 	Integer(int v)
 		:_value(v)
 	{}
 
+	// Values in [min_cached, max_cached] are shared per thread
+	static Ref<Integer> make(int v);
+
 	bool get(int* val) const override { (*val) = _value; return true; }
 
 private:
@@ -55,6 +196,8 @@ private:
 class Float : public Object
 {
 public:
+	DECLARE_POOLED_OBJECT(Float)
+
 	Float(float v)
 		:_value(v)
 	{}
@@ -68,27 +211,66 @@ private:
 class Bool : public Object
 {
 public:
+	DECLARE_POOLED_OBJECT(Bool)
+
 	Bool(bool v)
 		:_value(v)
 	{}
 
+	// Returns the per thread True/False instance
+	static Ref<Bool> make(bool v);
+
 	bool get(bool* val) const override { (*val) = _value; return true; }
 
 private:
 	bool _value;
 };
 
+// Strings are immutable. A slice keeps the string owning the characters
+// alive and views into its buffer instead of copying.
 class String : public Object
 {
 public:
+	DECLARE_POOLED_OBJECT(String)
+
 	String(std::string&& v)
 		:_value(std::move(v))
+		,_view(_value)
+	{}
+
+	String(Ref<String> owner, std::string_view view)
+		:_owner(std::move(owner))
+		,_view(view)
 	{}
 
-	bool get(std::string * val) const override { (*val) = _value; return true; }
+	bool get(std::string * val) const override { (*val) = _view; return true; }
+
+	bool get(std::string_view* val) const override { (*val) = _view; return true; }
+
+	bool get(String** val) override { (*val) = this; return true; }
+
+	void mark_shared() override;
+
+	void trace(Tracer& tracer) override;
+
+	void clear_references() override;
+
+	std::string_view get_view() const { return _view; }
+
+	size_t size() const { return _view.size(); }
+
+	// Characters [pos, pos + count) clamped to the string, shares the buffer
+	Ref<String> slice(size_t pos, size_t count = std::string_view::npos);
+
+	// Computed on first use, also by several threads sharing the string
+	size_t get_hash() const;
 
 private:
 	std::string _value;
+	Ref<String> _owner;
+	std::string_view _view;
+	// Zero until computed, a hash of zero is stored as one
+	mutable std::atomic<size_t> _hash = 0;
 };
 
 class Callable : public Object
@@ -107,12 +289,196 @@ private:
 class ArrayObj : public Object
 {
 public:
-	ArrayObj(std::vector<ObjectPtr> objects)
-		:_value(std::move(objects))
-	{}
+	// Storage is picked from the first stored elements: homogeneous int, float
+	// and bool arrays are kept packed, anything else falls back to Generic.
+	enum class ElementType
+	{
+		Empty,
+		Generic,
+		Int,
+		Float,
+		Bool
+	};
+
+	ArrayObj() = default;
+
+	ArrayObj(std::vector<ObjectPtr> objects);
+
+	bool get(ArrayObj** val) override { (*val) = this; return true; }
+
+	void mark_shared() override;
+
+	void trace(Tracer& tracer) override;
+
+	void clear_references() override;
 
-	bool get(std::vector<ObjectPtr>** val) override { (*val) = &_value; return true; }
+	ElementType get_element_type() const { return _type; }
+
+	size_t size() const;
+
+	ObjectPtr get_element(size_t index) const;
+
+	bool set_element(size_t index, ObjectPtr obj);
+
+	void append(ObjectPtr obj);
+
+	// Replaces the content with count copies of value
+	void assign(size_t count, const ObjectPtr& value);
+
+	// Sets every element to value, in place for packed storage
+	void fill(const ObjectPtr& value);
+
+	// Removes every element and releases external storage
+	void clear();
+
+	// Replaces the content with packed values
+	void assign(std::vector<int>&& values);
+
+	void assign(std::vector<float>&& values);
+
+	// Views packed elements stored outside of the array, e.g. in a mapped
+	// file. Owner keeps the memory alive. Read only storage is copied into
+	// the array on the first change. Writable storage is changed in place
+	// and fixes the size and the element type of the array.
+	void assign_external(ElementType type, std::shared_ptr<const void> owner, void* data, size_t count, bool writable);
+
+	bool is_external() const { return _external.data != nullptr; }
+
+	bool is_fixed() const { return _external.writable; }
+
+	// Parallel loops set elements from several threads, locking keeps the
+	// storage in place: external elements are copied in first and values
+	// of another element type are refused until the array is unlocked
+	void set_layout_locked(bool locked);
+
+	bool is_layout_locked() const { return _layout_locked; }
+
+	// Converts packed int storage to packed float storage, fails for fixed arrays
+	bool promote_to_floats();
+
+	// Drops the elements past count
+	void truncate(size_t count);
+
+	std::vector<ObjectPtr>& get_objects() { return _objects; }
+
+	std::span<const int> get_ints() const { return view(_ints); }
+
+	std::span<const float> get_floats() const { return view(_floats); }
+
+	std::span<const uint8_t> get_bools() const { return view(_bools); }
+
+	// Packed elements for changes in place
+	std::span<int> edit_ints() { return edit(_ints); }
+
+	std::span<float> edit_floats() { return edit(_floats); }
+
+	std::span<uint8_t> edit_bools() { return edit(_bools); }
+
+private:
+	struct External
+	{
+		std::shared_ptr<const void> owner;
+		void* data = nullptr;
+		size_t count = 0;
+		bool writable = false;
+	};
+
+	static ElementType get_object_type(const ObjectPtr& obj);
+
+	template <class T>
+	std::span<const T> view(const std::vector<T>& values) const
+	{
+		if (_external.data)
+		{
+			return { static_cast<const T*>(_external.data), _external.count };
+		}
+		return values;
+	}
+
+	template <class T>
+	std::span<T> edit(std::vector<T>& values)
+	{
+		if (_external.data && !_external.writable)
+		{
+			detach();
+		}
+		if (_external.data)
+		{
+			return { static_cast<T*>(_external.data), _external.count };
+		}
+		return values;
+	}
+
+	// Copies external elements into the array
+	void detach();
+
+	bool try_store_packed(size_t index, const ObjectPtr& obj);
+
+	bool try_append_packed(const ObjectPtr& obj);
+
+	void make_generic();
+
+	ElementType _type = ElementType::Empty;
+	std::vector<ObjectPtr> _objects;
+	std::vector<int> _ints;
+	std::vector<float> _floats;
+	std::vector<uint8_t> _bools;
+	External _external;
+	bool _layout_locked = false;
+};
+
+// Hash map with open addressing and linear probing. Keys are compared by
+// value for numbers, bools and strings and by identity for other objects.
+class MapObj : public Object
+{
+public:
+	MapObj() = default;
+
+	bool get(MapObj** val) override { (*val) = this; return true; }
+
+	void mark_shared() override;
+
+	void trace(Tracer& tracer) override;
+
+	void clear_references() override;
+
+	size_t size() const { return _size; }
+
+	ObjectPtr find(const ObjectPtr& key) const;
+
+	bool contains(const ObjectPtr& key) const;
+
+	void insert(ObjectPtr key, ObjectPtr value);
 
 private:
-	std::vector<ObjectPtr> _value;
+	struct Slot
+	{
+		size_t hash = 0;
+		ObjectPtr key;
+		ObjectPtr value;
+	};
+
+	static size_t hash_key(const Object& key);
+
+	static bool keys_equal(const Object& left, const Object& right);
+
+	const Slot* find_slot(const Object& key, size_t hash) const;
+
+	void grow();
+
+	std::vector<Slot> _slots;
+	size_t _size = 0;
+};
+
+// Sequence produced one value at a time, e.g. the lines of a file. interp
+// is the interpreter asking for the value.
+class IteratorObj : public Object
+{
+public:
+	bool get(IteratorObj** val) override { (*val) = this; return true; }
+
+	virtual bool has_next(Interpreter* interp) = 0;
+
+	// Null once the sequence is exhausted
+	virtual ObjectPtr next(Interpreter* interp) = 0;
 };
@@ -0,0 +1,117 @@
+#include "output.hpp"
+
+#include <algorithm>
+#include <charconv>
+
+namespace
+{
+	thread_local Output* current_output = nullptr;
+}
+
+Output::Output(FILE* stream, FlushPolicy policy, size_t threshold)
+	:_stream(stream)
+{
+	set_policy(policy, threshold);
+}
+
+Output::~Output()
+{
+	flush();
+}
+
+Output* Output::get_current()
+{
+	return current_output;
+}
+
+void Output::set_policy(FlushPolicy policy, size_t threshold)
+{
+	_policy = policy;
+	_threshold = policy == FlushPolicy::Exit ? max_buffer_size : threshold;
+	_buffer.reserve(std::min(_threshold, default_threshold));
+}
+
+void Output::write(std::string_view str)
+{
+	_buffer.append(str);
+	check_size();
+}
+
+void Output::write(char ch)
+{
+	_buffer.push_back(ch);
+	check_size();
+}
+
+void Output::write(int val)
+{
+	constexpr size_t max_size = 12;
+	char* begin = reserve(max_size);
+	const auto res = std::to_chars(begin, begin + max_size, val);
+	_buffer.resize(res.ptr - _buffer.data());
+	check_size();
+}
+
+void Output::write(float val)
+{
+	// Same digits as std::to_string used to print
+	constexpr size_t max_size = 64;
+	char* begin = reserve(max_size);
+	const auto res = std::to_chars(begin, begin + max_size, val, std::chars_format::fixed, 6);
+	_buffer.resize(res.ptr - _buffer.data());
+	check_size();
+}
+
+void Output::write(bool val)
+{
+	write(std::string_view{ val ? "true" : "false" });
+}
+
+void Output::end_line()
+{
+	_buffer.push_back('\n');
+	if (_policy == FlushPolicy::Line)
+	{
+		flush();
+	}
+	else
+	{
+		check_size();
+	}
+}
+
+void Output::flush()
+{
+	if (!_buffer.empty())
+	{
+		[[maybe_unused]] auto unused = fwrite(_buffer.data(), 1, _buffer.size(), _stream);
+		_buffer.clear();
+	}
+	fflush(_stream);
+}
+
+char* Output::reserve(size_t size)
+{
+	const auto offset = _buffer.size();
+	_buffer.resize(offset + size);
+	return _buffer.data() + offset;
+}
+
+void Output::check_size()
+{
+	if (_buffer.size() >= _threshold)
+	{
+		flush();
+	}
+}
+
+Output::Guard::Guard(Output* output)
+	:_previous(current_output)
+{
+	current_output = output;
+}
+
+Output::Guard::~Guard()
+{
+	current_output = _previous;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <string_view>
+
+enum class FlushPolicy
+{
+	// Flush after every completed line
+	Line,
+	// Flush once the buffer reaches the size threshold
+	Size,
+	// Flush only on __flush and at exit
+	Exit
+};
+
+// Interpreter owned buffer for script output. Numbers are formatted with
+// std::to_chars straight into the buffer, the stream is only written when
+// the flush policy asks for it, on flush() and on destruction.
+class Output
+{
+public:
+	static constexpr size_t default_threshold = 64 * 1024;
+
+	Output(FILE* stream, FlushPolicy policy = FlushPolicy::Size, size_t threshold = default_threshold);
+	Output(const Output&) = delete;
+	Output& operator=(const Output&) = delete;
+	~Output();
+
+	// Output of the interpreter running on the calling thread, if any
+	static Output* get_current();
+
+	void set_policy(FlushPolicy policy, size_t threshold = default_threshold);
+
+	FlushPolicy get_policy() const { return _policy; }
+
+	void write(std::string_view str);
+
+	void write(char ch);
+
+	void write(int val);
+
+	void write(float val);
+
+	void write(bool val);
+
+	void end_line();
+
+	void flush();
+
+	class Guard
+	{
+	public:
+		explicit Guard(Output* output);
+		Guard(const Guard&) = delete;
+		Guard& operator=(const Guard&) = delete;
+		~Guard();
+
+	private:
+		Output* _previous;
+	};
+
+private:
+	// Buffer is written out regardless of the policy past this size
+	static constexpr size_t max_buffer_size = 16 * 1024 * 1024;
+
+	char* reserve(size_t size);
+
+	void check_size();
+
+	FILE* _stream;
+	FlushPolicy _policy;
+	size_t _threshold;
+	std::string _buffer;
+};
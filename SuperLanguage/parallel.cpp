@@ -0,0 +1,200 @@
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+
+#include "thread_pool.hpp"
+
+namespace
+{
+	// Smaller chunks don't pay for their worker interpreter
+	constexpr size_t min_chunk_size = 64;
+	// Loops are made parallel by hand and their bodies are statements, even
+	// a few iterations are worth a worker
+	constexpr size_t min_loop_chunk_size = 1;
+	// Extra chunks even out elements of different cost
+	constexpr size_t chunks_per_thread = 4;
+
+	bool check_params(const Function& func, int expected)
+	{
+		const auto params = func.get_params_count();
+		if (params >= 0 && params != expected)
+		{
+			LOG_ERROR("Function {} takes {} arguments, {} expected", func.get_name(), params, expected);
+			return false;
+		}
+		return true;
+	}
+
+	// Runs body(worker, chunk, begin, end) over chunks of [0, total) and
+	// returns the chunk count, 0 when a chunk failed
+	template <class F>
+	size_t run_chunks(Interpreter* interp, size_t total, size_t min_chunk, F&& body)
+	{
+		auto& pool = ThreadPool::get_default();
+		const auto count = std::clamp(total / min_chunk, size_t{ 1 }, pool.get_concurrency() * chunks_per_thread);
+		const auto chunk_size = (total + count - 1) / count;
+
+		std::atomic<bool> failed = false;
+		pool.run(count, [&](size_t chunk)
+			{
+				if (failed.load(std::memory_order_relaxed))
+				{
+					return;
+				}
+
+				// The calling thread takes chunks too, keep them off its heap
+				Heap::Guard heap_guard{ nullptr };
+				const auto worker = interp->make_worker();
+				const auto begin = chunk * chunk_size;
+				if (!body(*worker, chunk, begin, std::min(begin + chunk_size, total)))
+				{
+					failed.store(true, std::memory_order_relaxed);
+				}
+			});
+		return failed ? 0 : count;
+	}
+}
+
+namespace parallel
+{
+	ObjectPtr map(Interpreter* interp, ArrayObj& arr, Function* func)
+	{
+		if (!check_params(*func, 1))
+		{
+			return {};
+		}
+
+		arr.mark_shared();
+		std::vector<std::vector<ObjectPtr>> chunk_results(arr.size() / min_chunk_size + 1);
+		const auto count = run_chunks(interp, arr.size(), min_chunk_size, [&](Interpreter& worker, size_t chunk, size_t begin, size_t end)
+			{
+				auto& results = chunk_results[chunk];
+				results.reserve(end - begin);
+				for (size_t i = begin; i < end; ++i)
+				{
+					const auto element = arr.get_element(i);
+					auto result = worker.call_function(func, { &element, 1 });
+					if (!result)
+					{
+						LOG_ERROR("Function {} returned no value for element {}", func->get_name(), i);
+						return false;
+					}
+					result->mark_shared();
+					results.emplace_back(std::move(result));
+				}
+				return true;
+			});
+
+		if (count == 0)
+		{
+			return {};
+		}
+
+		std::vector<ObjectPtr> results;
+		results.reserve(arr.size());
+		for (auto& chunk : chunk_results)
+		{
+			std::move(chunk.begin(), chunk.end(), std::back_inserter(results));
+		}
+		return make_object<ArrayObj>(std::move(results));
+	}
+
+	ObjectPtr reduce(Interpreter* interp, ArrayObj& arr, Function* func, ObjectPtr init)
+	{
+		if (!check_params(*func, 2))
+		{
+			return {};
+		}
+
+		arr.mark_shared();
+		std::vector<ObjectPtr> partials(arr.size() / min_chunk_size + 1);
+		const auto count = run_chunks(interp, arr.size(), min_chunk_size, [&](Interpreter& worker, size_t chunk, size_t begin, size_t end)
+			{
+				if (begin >= end)
+				{
+					return true;
+				}
+
+				ObjectPtr args[2] = { arr.get_element(begin) };
+				for (size_t i = begin + 1; i < end; ++i)
+				{
+					args[1] = arr.get_element(i);
+					args[0] = worker.call_function(func, args);
+					if (!args[0])
+					{
+						LOG_ERROR("Function {} returned no value for element {}", func->get_name(), i);
+						return false;
+					}
+				}
+				args[0]->mark_shared();
+				partials[chunk] = std::move(args[0]);
+				return true;
+			});
+
+		if (count == 0)
+		{
+			return {};
+		}
+
+		ObjectPtr args[2] = { std::move(init) };
+		for (auto& partial : partials)
+		{
+			if (!partial)
+			{
+				continue;
+			}
+
+			args[1] = std::move(partial);
+			args[0] = interp->call_function(func, args);
+			if (!args[0])
+			{
+				LOG_ERROR("Function {} returned no value", func->get_name());
+				return {};
+			}
+		}
+		return args[0];
+	}
+
+	void for_range(Interpreter* interp, ForRange* loop, std::span<const ObjectPtr> frame, int begin, int end)
+	{
+		for (const auto& value : frame)
+		{
+			if (value)
+			{
+				value->mark_shared();
+			}
+		}
+
+		// Iterations set their own elements, the storage may not be replaced meanwhile
+		std::vector<ArrayObj*> written;
+		for (const auto index : loop->get_written_arrays())
+		{
+			ArrayObj* arr = nullptr;
+			if (index < frame.size() && frame[index] && frame[index]->get(&arr) && !arr->is_layout_locked())
+			{
+				arr->set_layout_locked(true);
+				written.push_back(arr);
+			}
+		}
+
+		// Workers write lines straight away, keep what was printed before first
+		interp->get_output().flush();
+
+		const auto total = static_cast<size_t>(static_cast<int64_t>(end) - begin);
+		run_chunks(interp, total, min_loop_chunk_size, [&](Interpreter& worker, size_t chunk, size_t first, size_t last)
+			{
+				if (first < last)
+				{
+					worker.run_iterations(loop, frame, begin + static_cast<int>(first), begin + static_cast<int>(last));
+				}
+				return true;
+			});
+
+		for (const auto arr : written)
+		{
+			arr->set_layout_locked(false);
+		}
+	}
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "interpreter.hpp"
+
+// Data parallel helpers running a script function over array chunks, or the
+// body of a parallel for over chunks of its range, on the default thread
+// pool. Every chunk gets its own worker interpreter sharing the program of
+// interp. Values crossing threads are marked shared.
+namespace parallel
+{
+	// Array of func(element) for every element, in order
+	ObjectPtr map(Interpreter* interp, ArrayObj& arr, Function* func);
+
+	// Folds the elements with func(acc, element). Chunks are folded on their
+	// own first, so func has to be associative. init starts the final fold
+	// of the chunk results and is returned for an empty array.
+	ObjectPtr reduce(Interpreter* interp, ArrayObj& arr, Function* func, ObjectPtr init);
+
+	// Runs the iterations [begin, end) of a parallel for in chunks, each on
+	// a copy of frame. Values of the frame are shared, arrays the loop sets
+	// elements of keep their storage until the loop is done.
+	void for_range(Interpreter* interp, ForRange* loop, std::span<const ObjectPtr> frame, int begin, int end);
+}
@@ -1,7 +1,242 @@
 #include "parser.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <format>
+#include <set>
+#include <utility>
+
+#include "log.hpp"
+
+namespace
+{
+	// Natives changing objects passed to them, racy on values the
+	// iterations of a parallel loop share
+	constexpr std::string_view mutating_natives[] = {
+		"__array_add", "__array_append", "__array_fill", "__array_reverse", "__array_scale",
+		"__array_sort", "__array_stable_sort", "__array_unique", "__map_set", "__iter_next",
+		"__iter_has_next", "__file_write", "__file_write_line", "__file_close",
+		"__mapped_array_close", "__gc_collect", "__exit"
+	};
+
+	// Decides whether the iterations of a parallel for may run at the same
+	// time. The body may read outer variables but only declare and assign
+	// its own. Elements of outer arrays may be set at the index of the loop
+	// variable, each iteration writes its own element then. An array written
+	// so may only be read at that index too, any other use of it could see
+	// elements of other iterations. Called functions have their own frame
+	// and may assign their locals, changing objects is refused there as it
+	// can't be tied to one iteration.
+	class ParallelBodyCheck final : public NodeVisitor
+	{
+	public:
+		ParallelBodyCheck(size_t loop_var, const std::map<std::string, Function*, std::less<>>& functions)
+			:_loop_var(loop_var)
+			,_functions(functions)
+		{}
+
+		void check_body(Scope* body)
+		{
+			accept(body);
+			for (const auto array : _written_arrays)
+			{
+				if (_outer_uses.contains(array))
+				{
+					fail("uses an array it writes other than at the index of the loop variable");
+				}
+			}
+		}
+
+		// Empty when the loop can run in parallel
+		const std::string& get_reason() const { return _reason; }
+
+		std::vector<size_t> take_written_arrays() { return std::move(_written_arrays); }
+
+		void visit(Scope* node) override
+		{
+			for (Node* child : node->get_nodes())
+			{
+				accept(child);
+			}
+		}
+
+		void visit(BinaryOperation* node) override
+		{
+			accept(node->get_left());
+			accept(node->get_right());
+		}
+
+		void visit(Assign* node) override
+		{
+			if (!_callee && !node->is_declaration() && node->get_var_index() < _loop_var)
+			{
+				fail("assigns a variable declared outside of the loop");
+			}
+			if (dynamic_cast<Scope*>(node->get_expression()))
+			{
+				fail("defines a function");
+			}
+			accept(node->get_expression());
+		}
+
+		void visit(Variable* node) override
+		{
+			if (!_callee && node->get_stack_index() < _loop_var)
+			{
+				_outer_uses.insert(node->get_stack_index());
+			}
+		}
+
+		void visit(StackValue* node) override {}
+
+		void visit(ArrayNode* node) override
+		{
+			for (Node* element : node->get_array_nodes())
+			{
+				accept(element);
+			}
+		}
+
+		void visit(Function* node) override { fail("defines a function"); }
+
+		void visit(InternalFunction* node) override {}
+
+		void visit(Call* node) override
+		{
+			const auto name = node->get_function_name();
+			const auto& args = node->get_args();
+			// Element access at the loop variable is not a use of the whole array
+			const bool element_access = (name == "__set_array_element" || name == "__get_array_element") && is_own_element(args);
+			for (size_t i = element_access ? 1 : 0; i < args.size(); ++i)
+			{
+				accept(args[i]);
+			}
+
+			if (name == "__set_array_element")
+			{
+				check_element_write(node);
+			}
+			else if (std::ranges::find(mutating_natives, name) != std::end(mutating_natives))
+			{
+				fail(std::format("calls {}", name));
+			}
+			else if (!name.starts_with("__"))
+			{
+				check_function(name);
+			}
+		}
+
+		void visit(Spawn* node) override { accept(node->get_call()); }
+
+		void visit(Return* node) override
+		{
+			if (!_callee)
+			{
+				fail("returns from the enclosing function");
+			}
+			accept(node->get_expression());
+		}
+
+		void visit(Yield* node) override { fail("yields"); }
+
+		void visit(BranchIfElse* node) override
+		{
+			accept(node->get_expression());
+			accept(node->get_scope());
+			accept(node->get_else_scope());
+		}
+
+		void visit(Loop* node) override
+		{
+			accept(node->get_expression());
+			accept(node->get_scope());
+		}
+
+		void visit(ForRange* node) override
+		{
+			accept(node->get_begin());
+			accept(node->get_end());
+			accept(node->get_scope());
+		}
+
+		void accept(Node* node)
+		{
+			if (node && _reason.empty())
+			{
+				node->accept(*this);
+			}
+		}
+
+	private:
+		void fail(std::string reason)
+		{
+			if (_reason.empty())
+			{
+				_reason = std::move(reason);
+			}
+		}
+
+		bool is_own_element(const std::vector<Node*>& args) const
+		{
+			const auto array = args.size() >= 2 ? dynamic_cast<Variable*>(args[0]) : nullptr;
+			const auto index = args.size() >= 2 ? dynamic_cast<Variable*>(args[1]) : nullptr;
+			return !_callee && array && index && index->get_stack_index() == _loop_var && array->get_stack_index() < _loop_var;
+		}
+
+		void check_element_write(Call* node)
+		{
+			const auto& args = node->get_args();
+			const auto array = args.size() == 3 ? dynamic_cast<Variable*>(args[0]) : nullptr;
+			const auto index = args.size() == 3 ? dynamic_cast<Variable*>(args[1]) : nullptr;
+			if (_callee)
+			{
+				fail("sets array elements in a called function");
+				return;
+			}
+			if (!array || !index || index->get_stack_index() != _loop_var || array->get_stack_index() >= _loop_var)
+			{
+				fail("sets an element of a local array or at an index other than the loop variable");
+				return;
+			}
+			if (std::ranges::find(_written_arrays, array->get_stack_index()) == _written_arrays.end())
+			{
+				_written_arrays.push_back(array->get_stack_index());
+			}
+		}
+
+		void check_function(std::string_view name)
+		{
+			const auto it = _functions.find(name);
+			if (it == _functions.end())
+			{
+				fail(std::format("calls {} which is not defined before the loop", name));
+				return;
+			}
+			if (!_checked.insert(it->second).second)
+			{
+				return;
+			}
+			if (it->second->is_generator())
+			{
+				fail(std::format("calls generator {}", name));
+				return;
+			}
+			const bool callee = std::exchange(_callee, true);
+			accept(it->second->get_scope());
+			_callee = callee;
+		}
+
+		size_t _loop_var;
+		const std::map<std::string, Function*, std::less<>>& _functions;
+		std::set<const Function*> _checked;
+		std::vector<size_t> _written_arrays;
+		// Outer variables used other than for an element at the loop variable
+		std::set<size_t> _outer_uses;
+		std::string _reason;
+		// Inside a called function, stack indices are relative to its frame
+		bool _callee = false;
+	};
+}
 
 Parser::Parser(std::vector<Token>&& tokens)
 	:_tokens{std::move(tokens)}
@@ -14,8 +249,15 @@ Node* Parser::add_tokens(const std::vector<Token>& tokens)
 	const auto size = _tokens.size();
 	_tokens.insert(_tokens.end(), tokens.begin(), tokens.end());
 	_current = _tokens.begin() + size;
+	if (_current == _tokens.end())
+	{
+		return nullptr;
+	}
 
-	return statement();
+	const auto& token = *_current;
+	Node* node = statement();
+	set_position(node, token);
+	return node;
 }
 
 Node* Parser::parse()
@@ -32,6 +274,8 @@ void Parser::eat(TokType tok_type)
 	}
 	else
 	{
+		// Logged lines lead to the error, write them before aborting
+		details::flush_log();
 		puts("Parse error: expected ");
 		assert(false);
 	}
@@ -49,7 +293,9 @@ std::vector<Node*> Parser::statement_list()
 			break;
 		}
 
+		const auto& token = *_current;
 		nodes.push_back(statement());
+		set_position(nodes.back(), token);
 		if (!_skip_semicolon)
 		{
 			eat(TT_Semicolon);
@@ -99,6 +345,10 @@ Node* Parser::statement()
 		const auto var = dynamic_cast<Variable*>(node);
 		if(!var)
 		{
+			if (const auto call = dynamic_cast<Call*>(node))
+			{
+				call->set_statement(true);
+			}
 			return node;
 		}
 
@@ -131,6 +381,7 @@ Node* Parser::statement()
 
 		eat(TT_LParen);
 		const auto prev_counter = _index_counter;
+		const bool outer_yield = std::exchange(_yield_found, false);
 		_index_counter = 0;
 		int param_index = 0;
 		while (_current->type == TT_Id)
@@ -151,7 +402,18 @@ Node* Parser::statement()
 		
 		const auto scope = dynamic_cast<Scope*>(statement());
 		_index_counter = prev_counter;
-		return new Function(scope, std::move(_current_func), param_index);
+		auto func = new Function(scope, std::move(_current_func), param_index);
+		func->set_generator(std::exchange(_yield_found, outer_yield));
+		_functions.emplace(func->get_name(), func);
+		LOG_INFO(LogCategory::Parser, "Function {} parsed, {} params{}", func->get_name(), param_index, func->is_generator() ? ", generator" : "");
+		return func;
+	}
+
+	if(_current->type == TT_Spawn)
+	{
+		const auto spawn = spawn_expression();
+		spawn->get_call()->set_statement(true);
+		return spawn;
 	}
 
 	if(_current->type == TT_Ret)
@@ -160,6 +422,13 @@ Node* Parser::statement()
 		return new Return(expression());
 	}
 
+	if(_current->type == TT_Yield)
+	{
+		eat(TT_Yield);
+		_yield_found = true;
+		return new Yield(expression());
+	}
+
 	if(_current->type == TT_If)
 	{
 		eat(TT_If);
@@ -188,11 +457,22 @@ Node* Parser::statement()
 		return new Loop(expr, scope);
 	}
 
+	if(_current->type == TT_For || _current->type == TT_Parallel)
+	{
+		return for_statement();
+	}
+
 	return nullptr;
 }
 
 Node* Parser::expression()
 {
+	if (_current->type == TT_Spawn)
+	{
+		_current_context = TypeContext::None;
+		return spawn_expression();
+	}
+
 	_current_context = get_expression_context();
 	
 	if(_current_context == TypeContext::String)
@@ -501,6 +781,7 @@ Parser::TypeContext Parser::get_variable_context(const std::string& name) const
 
 Node* Parser::resolve_id()
 {
+	const auto& token = *_current;
 	std::string name = _current->name;
 	const auto var = get_variable();
 
@@ -517,11 +798,76 @@ Node* Parser::resolve_id()
 			}
 		}
 		eat(TT_RParen);
-		return new Call(std::move(args), std::move(name));
+		auto call = new Call(std::move(args), std::move(name));
+		set_position(call, token);
+		return call;
 	}
 	return var;
 }
 
+void Parser::set_position(Node* node, const Token& token)
+{
+	// Calls keep the position of their name, statements start at their first token
+	if (node && node->get_line() == 0)
+	{
+		node->set_position(token.line, token.pos);
+	}
+}
+
+Spawn* Parser::spawn_expression()
+{
+	eat(TT_Spawn);
+	const auto call = dynamic_cast<Call*>(resolve_id());
+	if (!call)
+	{
+		details::flush_log();
+		puts("Parse error: spawn expects a function call");
+		assert(false);
+	}
+	return new Spawn(call);
+}
+
+ForRange* Parser::for_statement()
+{
+	const bool parallel = _current->type == TT_Parallel;
+	const auto line = _current->line;
+	if (parallel)
+	{
+		eat(TT_Parallel);
+	}
+	eat(TT_For);
+	const std::string name = _current->name;
+	eat(TT_Id);
+	eat(TT_In);
+	Node* begin = expression();
+	eat(TT_Range);
+	Node* end = expression();
+
+	// The loop variable belongs to the body, its slot is free again after the loop
+	const size_t var_index = _index_counter++;
+	auto* var = new Variable(std::format("{}_{}_{}", _scope_level + 1, name, _current_func), var_index);
+	_variables.insert_or_assign(var->get_name(), VariableInfo{ TypeContext::Number, var });
+
+	const auto scope = dynamic_cast<Scope*>(statement());
+	_index_counter = var_index;
+
+	auto loop = new ForRange(var_index, begin, end, scope);
+	if (parallel && scope)
+	{
+		ParallelBodyCheck check{ var_index, _functions };
+		check.check_body(scope);
+		if (check.get_reason().empty())
+		{
+			loop->set_parallel(check.take_written_arrays());
+		}
+		else
+		{
+			LOG_ERROR("Line {}: parallel for runs sequentially, its body {}", line, check.get_reason());
+		}
+	}
+	return loop;
+}
+
 Parser::TypeContext Parser::get_expression_context() const
 {
 	auto it = _current;
@@ -533,6 +879,12 @@ Parser::TypeContext Parser::get_expression_context() const
 			return context;
 		}
 
+		// Tasks are only known to __await
+		if(it->type == TT_Spawn)
+		{
+			return TypeContext::None;
+		}
+
 		if(it->type == TT_Equal || it->type == TT_Greater || it->type == TT_Less)
 		{
 			return TypeContext::Bool;
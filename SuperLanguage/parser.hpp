@@ -56,6 +56,12 @@ private:
 
 	Node* resolve_id();
 
+	Spawn* spawn_expression();
+
+	ForRange* for_statement();
+
+	static void set_position(Node* node, const Token& token);
+
 private:
 	
 
@@ -76,4 +82,8 @@ private:
 	size_t _index_counter = 0;
 	int _scope_level = 0;
 	std::string _current_func;
+	// Set when the function being parsed contains yield
+	bool _yield_found = false;
+	// Functions parsed so far, parallel loops check the ones they call
+	std::map<std::string, Function*, std::less<>> _functions;
 };
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+
+struct PoolStats
+{
+	size_t allocations = 0;
+	size_t reused = 0;
+	size_t chunks = 0;
+};
+
+namespace pool_details
+{
+	// Chunks are owned by the process and never returned, so a slot freed on
+	// another thread can safely be pushed to that thread's free list.
+	void* allocate_chunk(size_t size);
+}
+
+// Per-thread free list of fixed size slots for one object type.
+// Used through class specific operator new/delete of the hot value types.
+template <class T>
+class ObjectPool
+{
+public:
+	static void* allocate()
+	{
+		auto& state = _state;
+		++state.stats.allocations;
+		if (!state.free_list)
+		{
+			refill(state);
+		}
+		else
+		{
+			++state.stats.reused;
+		}
+
+		Slot* slot = state.free_list;
+		state.free_list = slot->next;
+		return slot;
+	}
+
+	static void deallocate(void* ptr)
+	{
+		auto& state = _state;
+		auto* slot = static_cast<Slot*>(ptr);
+		slot->next = state.free_list;
+		state.free_list = slot;
+	}
+
+	static const PoolStats& get_stats() { return _state.stats; }
+
+private:
+	union Slot
+	{
+		Slot* next;
+		alignas(T) std::byte storage[sizeof(T)];
+	};
+
+	struct State
+	{
+		Slot* free_list = nullptr;
+		PoolStats stats;
+	};
+
+	static constexpr size_t slots_per_chunk = 256;
+
+	static void refill(State& state)
+	{
+		auto* slots = static_cast<Slot*>(pool_details::allocate_chunk(sizeof(Slot) * slots_per_chunk));
+		for (size_t i = 0; i < slots_per_chunk; ++i)
+		{
+			slots[i].next = state.free_list;
+			state.free_list = &slots[i];
+		}
+		++state.stats.chunks;
+	}
+
+	static thread_local State _state;
+};
+
+template <class T>
+thread_local typename ObjectPool<T>::State ObjectPool<T>::_state;
+
+#define DECLARE_POOLED_OBJECT(type) \
+	static void* operator new(size_t) { return ObjectPool<type>::allocate(); } \
+	static void operator delete(void* ptr) { ObjectPool<type>::deallocate(ptr); }
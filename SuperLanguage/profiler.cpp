@@ -0,0 +1,193 @@
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <format>
+#include <set>
+
+#include "nodes.hpp"
+
+Profiler::Profiler(std::chrono::microseconds interval)
+	:_interval(interval)
+{
+}
+
+Profiler::~Profiler()
+{
+	stop();
+}
+
+Profiler::Stack* Profiler::attach(const Stack* parent)
+{
+	auto stack = std::make_unique<Stack>();
+	if (parent)
+	{
+		const auto depth = std::min(parent->_depth.load(std::memory_order_acquire), Stack::max_depth);
+		for (size_t i = 0; i < depth; ++i)
+		{
+			stack->_frames[i].func.store(parent->_frames[i].func.load(std::memory_order_relaxed), std::memory_order_relaxed);
+			stack->_frames[i].line.store(parent->_frames[i].line.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		}
+		stack->_depth.store(depth, std::memory_order_relaxed);
+	}
+
+	std::lock_guard lock{ _mutex };
+	_stacks.push_back(std::move(stack));
+	return _stacks.back().get();
+}
+
+void Profiler::detach(Stack* stack)
+{
+	std::lock_guard lock{ _mutex };
+	std::erase_if(_stacks, [stack](const auto& item) { return item.get() == stack; });
+}
+
+void Profiler::start()
+{
+	if (!_thread.joinable())
+	{
+		_stop = false;
+		_thread = std::thread([this] { sample_loop(); });
+	}
+}
+
+void Profiler::stop()
+{
+	if (_thread.joinable())
+	{
+		{
+			std::lock_guard lock{ _mutex };
+			_stop = true;
+		}
+		_wake.notify_one();
+		_thread.join();
+	}
+}
+
+void Profiler::sample_loop()
+{
+	std::unique_lock lock{ _mutex };
+	while (!_wake.wait_for(lock, _interval, [this] { return _stop; }))
+	{
+		take_samples();
+	}
+}
+
+void Profiler::take_samples()
+{
+	std::vector<FrameKey> frames;
+	for (const auto& stack : _stacks)
+	{
+		const auto depth = std::min(stack->_depth.load(std::memory_order_acquire), Stack::max_depth);
+		if (depth == 0)
+		{
+			continue;
+		}
+
+		frames.clear();
+		for (size_t i = 0; i < depth; ++i)
+		{
+			const auto& frame = stack->_frames[i];
+			frames.emplace_back(frame.func.load(std::memory_order_relaxed), frame.line.load(std::memory_order_relaxed));
+		}
+		++_samples[frames];
+		++_sample_count;
+	}
+}
+
+double Profiler::to_ms(size_t samples) const
+{
+	return static_cast<double>(samples) * _interval.count() / 1000.0;
+}
+
+std::string Profiler::get_frame_name(const FrameKey& frame, bool with_line)
+{
+	const std::string_view name = frame.first ? std::string_view{ frame.first->get_name() } : "main";
+	if (with_line && frame.second > 0)
+	{
+		return std::format("{}:{}", name, frame.second);
+	}
+	return std::string{ name };
+}
+
+void Profiler::write_flat(FILE* stream) const
+{
+	struct Times
+	{
+		size_t self = 0;
+		size_t inclusive = 0;
+	};
+
+	// Recursive frames count once per sample for the inclusive time
+	std::map<std::string, Times> functions;
+	std::map<std::string, Times> lines;
+	for (const auto& [frames, count] : _samples)
+	{
+		std::set<std::string> seen_functions;
+		std::set<std::string> seen_lines;
+		for (const auto& frame : frames)
+		{
+			auto function = get_frame_name(frame, false);
+			auto line = get_frame_name(frame, true);
+			if (seen_functions.insert(function).second)
+			{
+				functions[std::move(function)].inclusive += count;
+			}
+			if (seen_lines.insert(line).second)
+			{
+				lines[std::move(line)].inclusive += count;
+			}
+		}
+		functions[get_frame_name(frames.back(), false)].self += count;
+		lines[get_frame_name(frames.back(), true)].self += count;
+	}
+
+	const auto total = std::max<size_t>(_sample_count, 1);
+	auto write_table = [&](std::string_view title, const std::map<std::string, Times>& table)
+	{
+		std::vector<std::pair<std::string, Times>> rows{ table.begin(), table.end() };
+		std::ranges::stable_sort(rows, [](const auto& l, const auto& r)
+			{
+				return l.second.self != r.second.self ? l.second.self > r.second.self : l.second.inclusive > r.second.inclusive;
+			});
+
+		auto header = std::format("\n{:>7} {:>10} {:>7} {:>10}  {}\n", "self%", "self ms", "total%", "total ms", title);
+		fputs(header.c_str(), stream);
+		for (const auto& [name, times] : rows)
+		{
+			const auto row = std::format("{:>6.1f}% {:>10.1f} {:>6.1f}% {:>10.1f}  {}\n",
+				100.0 * times.self / total, to_ms(times.self),
+				100.0 * times.inclusive / total, to_ms(times.inclusive), name);
+			fputs(row.c_str(), stream);
+		}
+	};
+
+	const auto summary = std::format("{} samples, one every {} us\n", _sample_count, _interval.count());
+	fputs(summary.c_str(), stream);
+	write_table("function", functions);
+	write_table("line", lines);
+}
+
+void Profiler::write_collapsed(FILE* stream) const
+{
+	// Functions of the same name merge, output is sorted by stack
+	std::map<std::string, size_t> stacks;
+	for (const auto& [frames, count] : _samples)
+	{
+		std::string name;
+		for (const auto& frame : frames)
+		{
+			if (!name.empty())
+			{
+				name += ';';
+			}
+			name += get_frame_name(frame, true);
+		}
+		stacks[std::move(name)] += count;
+	}
+
+	for (const auto& [name, count] : stacks)
+	{
+		const auto line = std::format("{} {}\n", name, count);
+		fputs(line.c_str(), stream);
+	}
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+class Function;
+
+// Sampling profiler for script functions and lines. Every interpreter
+// publishes a shadow call stack holding the current line of each frame,
+// a sampler thread copies all stacks at a fixed interval. Only the owning
+// thread writes a stack, so a sample taken during a call or a return may
+// be one frame off.
+class Profiler
+{
+public:
+	static constexpr std::chrono::microseconds default_interval{ 1000 };
+
+	// Shadow call stack of one interpreter
+	class Stack
+	{
+	public:
+		void push(const Function* func)
+		{
+			const auto depth = _depth.load(std::memory_order_relaxed);
+			if (depth < max_depth)
+			{
+				_frames[depth].func.store(func, std::memory_order_relaxed);
+				_frames[depth].line.store(0, std::memory_order_relaxed);
+			}
+			_depth.store(depth + 1, std::memory_order_release);
+		}
+
+		void pop()
+		{
+			_depth.store(_depth.load(std::memory_order_relaxed) - 1, std::memory_order_release);
+		}
+
+		void set_line(int line)
+		{
+			const auto depth = _depth.load(std::memory_order_relaxed);
+			if (depth > 0 && depth <= max_depth)
+			{
+				_frames[depth - 1].line.store(line, std::memory_order_relaxed);
+			}
+		}
+
+	private:
+		friend class Profiler;
+
+		// Deeper frames are counted but not sampled
+		static constexpr size_t max_depth = 128;
+
+		struct Frame
+		{
+			std::atomic<const Function*> func = nullptr;
+			std::atomic<int> line = 0;
+		};
+
+		std::array<Frame, max_depth> _frames;
+		std::atomic<size_t> _depth = 0;
+	};
+
+	explicit Profiler(std::chrono::microseconds interval = default_interval);
+	Profiler(const Profiler&) = delete;
+	Profiler& operator=(const Profiler&) = delete;
+	~Profiler();
+
+	// Stack for a new interpreter. Workers start with a copy of the stack
+	// of the interpreter they were made by, their samples show the caller.
+	Stack* attach(const Stack* parent = nullptr);
+
+	void detach(Stack* stack);
+
+	void start();
+
+	void stop();
+
+	// Self and inclusive time per function and per line, most self time first
+	void write_flat(FILE* stream) const;
+
+	// One line per distinct stack, outermost frame first, as read by flamegraph tools
+	void write_collapsed(FILE* stream) const;
+
+private:
+	// Function and line, top level code has no function
+	using FrameKey = std::pair<const Function*, int>;
+
+	void sample_loop();
+
+	void take_samples();
+
+	double to_ms(size_t samples) const;
+
+	static std::string get_frame_name(const FrameKey& frame, bool with_line);
+
+	std::chrono::microseconds _interval;
+	std::mutex _mutex;
+	std::condition_variable _wake;
+	bool _stop = false;
+	std::thread _thread;
+	std::vector<std::unique_ptr<Stack>> _stacks;
+	// Written by the sampler thread only, read once it has stopped
+	std::map<std::vector<FrameKey>, size_t> _samples;
+	size_t _sample_count = 0;
+};
@@ -0,0 +1,111 @@
+#include "program.hpp"
+
+namespace
+{
+	// Marks every literal of the tree shared, function bodies included
+	class ConstantSharer final : public NodeVisitor
+	{
+	public:
+		void visit(Scope* node) override
+		{
+			for (Node* child : node->get_nodes())
+			{
+				accept(child);
+			}
+		}
+
+		void visit(BinaryOperation* node) override
+		{
+			accept(node->get_left());
+			accept(node->get_right());
+		}
+
+		void visit(Assign* node) override { accept(node->get_expression()); }
+
+		void visit(Variable* node) override {}
+
+		void visit(StackValue* node) override
+		{
+			if (const auto obj = node->get_object())
+			{
+				obj->mark_shared();
+			}
+		}
+
+		void visit(ArrayNode* node) override
+		{
+			for (Node* element : node->get_array_nodes())
+			{
+				accept(element);
+			}
+		}
+
+		void visit(Function* node) override { accept(node->get_scope()); }
+
+		void visit(InternalFunction* node) override {}
+
+		void visit(Call* node) override
+		{
+			for (Node* arg : node->get_args())
+			{
+				accept(arg);
+			}
+		}
+
+		void visit(Spawn* node) override { accept(node->get_call()); }
+
+		void visit(Return* node) override { accept(node->get_expression()); }
+
+		void visit(Yield* node) override { accept(node->get_expression()); }
+
+		void visit(BranchIfElse* node) override
+		{
+			accept(node->get_expression());
+			accept(node->get_scope());
+			accept(node->get_else_scope());
+		}
+
+		void visit(Loop* node) override
+		{
+			accept(node->get_expression());
+			accept(node->get_scope());
+		}
+
+		void visit(ForRange* node) override
+		{
+			accept(node->get_begin());
+			accept(node->get_end());
+			accept(node->get_scope());
+		}
+
+		void accept(Node* node)
+		{
+			if (node)
+			{
+				node->accept(*this);
+			}
+		}
+	};
+}
+
+Program::Program(Node* root)
+	:_root(root)
+{
+	share_constants(_root);
+}
+
+Program::~Program()
+{
+	delete _root;
+}
+
+void Program::share_constants(Node* node)
+{
+	ConstantSharer{}.accept(node);
+}
+
+void Program::add_function(std::unique_ptr<Function> func)
+{
+	_functions[func->get_name()] = func.get();
+	_owned_functions.emplace_back(std::move(func));
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "nodes.hpp"
+
+// Parsed script shared by any number of interpreters, each with its own
+// stack, heap and output. Native functions are registered before the first
+// interpreter is created. After that the program is not changed, literals
+// are shared so every interpreter can push them on its own stack, possibly
+// on another thread.
+class Program
+{
+public:
+	explicit Program(Node* root);
+	Program(const Program&) = delete;
+	Program& operator=(const Program&) = delete;
+	~Program();
+
+	// Marks the literals of node shared, for nodes run outside of the tree
+	static void share_constants(Node* node);
+
+	Node* get_root() const { return _root; }
+
+	void add_function(std::unique_ptr<Function> func);
+
+	const std::map<std::string, Function*, std::less<>>& get_functions() const { return _functions; }
+
+private:
+	Node* _root;
+	std::map<std::string, Function*, std::less<>> _functions;
+	std::vector<std::unique_ptr<Function>> _owned_functions;
+};
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+#include <utility>
+
+// Intrusive reference to an object exposing add_ref()/release().
+// Copies touch only the counter stored inside the object itself,
+// there is no separate control block.
+template <class T>
+class Ref
+{
+public:
+	Ref() = default;
+
+	Ref(std::nullptr_t) {}
+
+	Ref(T* ptr)
+		:_ptr(ptr)
+	{
+		if (_ptr)
+		{
+			_ptr->add_ref();
+		}
+	}
+
+	Ref(const Ref& other)
+		:Ref(other._ptr)
+	{}
+
+	Ref(Ref&& other) noexcept
+		:_ptr(std::exchange(other._ptr, nullptr))
+	{}
+
+	template <class U>
+	Ref(const Ref<U>& other)
+		:Ref(other.get())
+	{}
+
+	template <class U>
+	Ref(Ref<U>&& other) noexcept
+		:_ptr(other.detach())
+	{}
+
+	~Ref()
+	{
+		if (_ptr)
+		{
+			_ptr->release();
+		}
+	}
+
+	Ref& operator=(const Ref& other)
+	{
+		Ref(other).swap(*this);
+		return *this;
+	}
+
+	Ref& operator=(Ref&& other) noexcept
+	{
+		Ref(std::move(other)).swap(*this);
+		return *this;
+	}
+
+	void reset()
+	{
+		Ref().swap(*this);
+	}
+
+	void swap(Ref& other) noexcept
+	{
+		std::swap(_ptr, other._ptr);
+	}
+
+	// Gives up ownership without touching the counter
+	T* detach()
+	{
+		return std::exchange(_ptr, nullptr);
+	}
+
+	T* get() const { return _ptr; }
+
+	T* operator->() const { return _ptr; }
+
+	T& operator*() const { return *_ptr; }
+
+	explicit operator bool() const { return _ptr != nullptr; }
+
+	template <class U>
+	bool operator==(const Ref<U>& other) const { return _ptr == other.get(); }
+
+	bool operator==(std::nullptr_t) const { return _ptr == nullptr; }
+
+private:
+	T* _ptr = nullptr;
+};
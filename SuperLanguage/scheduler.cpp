@@ -0,0 +1,246 @@
+#include "scheduler.hpp"
+
+#include <algorithm>
+
+namespace
+{
+	// Scheduler and deque of the calling worker thread
+	thread_local Scheduler* current_scheduler = nullptr;
+	thread_local size_t current_index = 0;
+}
+
+Scheduler::Scheduler(size_t threads)
+	:_target(std::max<size_t>(threads, 1))
+	,_active(_target)
+{
+	threads = _target;
+	_workers.reserve(threads);
+	for (size_t i = 0; i < threads; ++i)
+	{
+		_workers.emplace_back(std::make_unique<Worker>());
+	}
+
+	_threads.reserve(threads);
+	for (size_t i = 0; i < threads; ++i)
+	{
+		_threads.emplace_back([this, i] { worker_loop(i); });
+	}
+}
+
+Scheduler::~Scheduler()
+{
+	{
+		std::lock_guard lock{ _mutex };
+		_stop = true;
+		_stopping.store(true);
+		for (const auto guard : _blocked)
+		{
+			guard->_wake();
+		}
+	}
+	_wake.notify_all();
+	_spare_wake.notify_all();
+	// No spares are started once _stop is set
+	for (auto& thread : _threads)
+	{
+		thread.join();
+	}
+}
+
+Scheduler& Scheduler::get_default()
+{
+	// Unlike the thread pool every core gets a worker, spawned tasks run
+	// even when the spawning thread never waits for them
+	static Scheduler scheduler{ std::max(std::thread::hardware_concurrency(), 1u) };
+	return scheduler;
+}
+
+void Scheduler::submit(Job job)
+{
+	const bool on_worker = current_scheduler == this;
+	const auto index = on_worker ? current_index : _next_worker.fetch_add(1, std::memory_order_relaxed) % _workers.size();
+	{
+		auto& worker = *_workers[index];
+		std::lock_guard lock{ worker.mutex };
+		worker.jobs.push_back(std::move(job));
+		_queued.fetch_add(1);
+	}
+
+	{
+		// Orders the counter with workers about to sleep
+		std::lock_guard lock{ _mutex };
+	}
+	_wake.notify_one();
+}
+
+void Scheduler::wait_until(const std::function<bool()>& done)
+{
+	const size_t home = current_scheduler == this ? current_index : 0;
+	while (!done())
+	{
+		if (try_run_one(home))
+		{
+			continue;
+		}
+
+		std::unique_lock lock{ _mutex };
+		++_waiting;
+		_finished.wait(lock, [&] { return done() || _queued.load() > 0; });
+		--_waiting;
+	}
+}
+
+void Scheduler::worker_loop(size_t index)
+{
+	current_scheduler = this;
+	current_index = index;
+	while (true)
+	{
+		if (try_run_one(index))
+		{
+			continue;
+		}
+
+		std::unique_lock lock{ _mutex };
+		_wake.wait(lock, [this] { return _stop || _queued.load() > 0; });
+		if (_stop && _queued.load() == 0)
+		{
+			return;
+		}
+	}
+}
+
+void Scheduler::spare_loop(size_t index)
+{
+	current_scheduler = this;
+	current_index = index % _workers.size();
+	while (true)
+	{
+		{
+			std::unique_lock lock{ _mutex };
+			if (_active > _target && !_stop)
+			{
+				// Blocked workers are back, wait until one blocks again
+				--_active;
+				++_idle_spares;
+				_spare_wake.wait(lock, [this] { return _stop || _spare_wakeups > 0; });
+				if (_stop)
+				{
+					return;
+				}
+				--_spare_wakeups;
+			}
+			if (_stop && _queued.load() == 0)
+			{
+				return;
+			}
+		}
+
+		if (try_run_one(current_index))
+		{
+			continue;
+		}
+
+		std::unique_lock lock{ _mutex };
+		_wake.wait(lock, [this] { return _stop || _queued.load() > 0; });
+	}
+}
+
+void Scheduler::enter_blocking(BlockingGuard* guard)
+{
+	std::lock_guard lock{ _mutex };
+	_blocked.push_back(guard);
+	--_active;
+	if (_stop || _active >= _target)
+	{
+		return;
+	}
+
+	// The replacement counts as active from here on
+	++_active;
+	if (_idle_spares > 0)
+	{
+		--_idle_spares;
+		++_spare_wakeups;
+		_spare_wake.notify_one();
+	}
+	else
+	{
+		const auto index = _threads.size();
+		_threads.emplace_back([this, index] { spare_loop(index); });
+	}
+}
+
+void Scheduler::leave_blocking(BlockingGuard* guard)
+{
+	std::lock_guard lock{ _mutex };
+	std::erase(_blocked, guard);
+	++_active;
+}
+
+Scheduler::BlockingGuard::BlockingGuard(std::function<void()> wake)
+	:_scheduler(current_scheduler)
+	,_wake(std::move(wake))
+{
+	if (_scheduler)
+	{
+		_scheduler->enter_blocking(this);
+	}
+}
+
+Scheduler::BlockingGuard::~BlockingGuard()
+{
+	if (_scheduler)
+	{
+		_scheduler->leave_blocking(this);
+	}
+}
+
+bool Scheduler::BlockingGuard::is_stopping() const
+{
+	return _scheduler && _scheduler->_stopping.load();
+}
+
+bool Scheduler::try_run_one(size_t home)
+{
+	const bool own = current_scheduler == this;
+	const auto count = _workers.size();
+	for (size_t i = 0; i < count; ++i)
+	{
+		auto& worker = *_workers[(home + i) % count];
+		Job job;
+		{
+			std::lock_guard lock{ worker.mutex };
+			if (worker.jobs.empty())
+			{
+				continue;
+			}
+
+			if (own && i == 0)
+			{
+				job = std::move(worker.jobs.back());
+				worker.jobs.pop_back();
+			}
+			else
+			{
+				job = std::move(worker.jobs.front());
+				worker.jobs.pop_front();
+			}
+			_queued.fetch_sub(1);
+		}
+
+		job();
+		notify_finished();
+		return true;
+	}
+	return false;
+}
+
+void Scheduler::notify_finished()
+{
+	std::lock_guard lock{ _mutex };
+	if (_waiting != 0)
+	{
+		_finished.notify_all();
+	}
+}
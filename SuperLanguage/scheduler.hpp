@@ -0,0 +1,105 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work stealing scheduler for script tasks. Every worker thread owns a
+// deque: jobs it submits are pushed and popped at the back, so nested fan
+// outs run depth first, idle workers steal from the front of the others.
+// Jobs submitted from other threads are spread over the deques. A thread
+// waiting for a job runs other jobs meanwhile instead of blocking.
+//
+// A worker about to block outside the scheduler, e.g. on a channel, hands
+// its place to a spare thread so blocked jobs can't starve queued ones.
+// Spares go idle again once the blocked workers are back.
+//
+// Jobs still queued when the scheduler is destroyed are run first. Jobs
+// blocked outside the scheduler are woken then and have to give up, they
+// would otherwise keep the process from exiting.
+class Scheduler
+{
+public:
+	using Job = std::function<void()>;
+
+	explicit Scheduler(size_t threads);
+	Scheduler(const Scheduler&) = delete;
+	Scheduler& operator=(const Scheduler&) = delete;
+	~Scheduler();
+
+	// Shared scheduler with one thread per core
+	static Scheduler& get_default();
+
+	void submit(Job job);
+
+	// Runs queued jobs until done() returns true. done is checked after
+	// every job and whenever a job finishes on another thread.
+	void wait_until(const std::function<bool()>& done);
+
+	// Marks the calling thread blocked for the guard lifetime. Only worker
+	// threads are replaced, other threads never run jobs unless waiting.
+	// wake is called when the scheduler stops meanwhile, the blocking wait
+	// must then check is_stopping and give up.
+	class BlockingGuard
+	{
+	public:
+		explicit BlockingGuard(std::function<void()> wake);
+		BlockingGuard(const BlockingGuard&) = delete;
+		BlockingGuard& operator=(const BlockingGuard&) = delete;
+		~BlockingGuard();
+
+		bool is_stopping() const;
+
+	private:
+		friend class Scheduler;
+
+		Scheduler* _scheduler;
+		std::function<void()> _wake;
+	};
+
+private:
+	struct Worker
+	{
+		std::mutex mutex;
+		std::deque<Job> jobs;
+	};
+
+	void worker_loop(size_t index);
+
+	void spare_loop(size_t index);
+
+	void enter_blocking(BlockingGuard* guard);
+
+	void leave_blocking(BlockingGuard* guard);
+
+	// Deque home first, then the others in order. Only the owner of a
+	// deque takes jobs from its back.
+	bool try_run_one(size_t home);
+
+	void notify_finished();
+
+	std::vector<std::unique_ptr<Worker>> _workers;
+	std::vector<std::thread> _threads;
+	std::atomic<size_t> _queued = 0;
+	std::atomic<size_t> _next_worker = 0;
+	std::mutex _mutex;
+	// Workers sleep on _wake, threads in wait_until on _finished
+	std::condition_variable _wake;
+	std::condition_variable _finished;
+	size_t _waiting = 0;
+	bool _stop = false;
+	// Same as _stop, read by blocked jobs without the mutex
+	std::atomic<bool> _stopping = false;
+	std::vector<BlockingGuard*> _blocked;
+	// Workers and spares not blocked, kept at _target while any worker blocks
+	size_t _target;
+	size_t _active;
+	size_t _idle_spares = 0;
+	size_t _spare_wakeups = 0;
+	std::condition_variable _spare_wake;
+};
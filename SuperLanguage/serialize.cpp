@@ -0,0 +1,419 @@
+#include "serialize.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "log.hpp"
+#include "mapped_file.hpp"
+
+namespace
+{
+	using ElementType = ArrayObj::ElementType;
+
+	static_assert(sizeof(int) == 4 && sizeof(float) == 4, "Packed arrays are stored as 32 bit values");
+
+	// Reads as "SLB\0" on little endian hosts, a big endian host sees a different number
+	constexpr uint32_t magic = 0x00424C53;
+	constexpr uint32_t version = 1;
+
+	// Packed payloads start at multiples of this from the file start, the
+	// mapping itself is page aligned
+	constexpr size_t payload_alignment = 8;
+
+	struct Header
+	{
+		uint32_t magic;
+		uint32_t version;
+	};
+
+	// Every value starts with its tag. Strings and arrays are numbered in the
+	// order they are written, Ref holds that number as uint32.
+	enum class Tag : uint8_t
+	{
+		Int,			// int32
+		Float,			// float
+		Bool,			// uint8
+		String,			// uint64 length, characters
+		Array,			// uint64 count, values
+		IntArray,		// uint64 count, padding, int32 values
+		FloatArray,		// uint64 count, padding, float values
+		BoolArray,		// uint64 count, padding, uint8 values
+		Ref
+	};
+
+	class Writer
+	{
+	public:
+		explicit Writer(FILE* stream)
+			:_stream(stream)
+		{
+			write_raw(Header{ magic, version });
+		}
+
+		bool failed() const { return _failed; }
+
+		bool write_value(Object& obj)
+		{
+			if (int ival; obj.get(&ival))
+			{
+				write_tag(Tag::Int);
+				write_raw(ival);
+				return true;
+			}
+			if (float fval; obj.get(&fval))
+			{
+				write_tag(Tag::Float);
+				write_raw(fval);
+				return true;
+			}
+			if (bool bval; obj.get(&bval))
+			{
+				write_tag(Tag::Bool);
+				write_raw(static_cast<uint8_t>(bval));
+				return true;
+			}
+			if (String* str; obj.get(&str))
+			{
+				if (!write_reference(str))
+				{
+					const auto view = str->get_view();
+					write_tag(Tag::String);
+					write_raw(static_cast<uint64_t>(view.size()));
+					write_bytes(view.data(), view.size());
+				}
+				return true;
+			}
+			if (ArrayObj* arr; obj.get(&arr))
+			{
+				return write_reference(arr) || write_array(*arr);
+			}
+
+			LOG_ERROR("Only integers, floats, bools, strings and arrays can be saved");
+			return false;
+		}
+
+	private:
+		bool write_array(ArrayObj& arr)
+		{
+			switch (arr.get_element_type())
+			{
+			case ElementType::Int:		write_packed(Tag::IntArray, arr.get_ints());		return true;
+			case ElementType::Float:	write_packed(Tag::FloatArray, arr.get_floats());	return true;
+			case ElementType::Bool:		write_packed(Tag::BoolArray, arr.get_bools());		return true;
+			default:
+				break;
+			}
+
+			const auto& objects = arr.get_objects();
+			write_tag(Tag::Array);
+			write_raw(static_cast<uint64_t>(objects.size()));
+			for (const auto& obj : objects)
+			{
+				if (!write_value(*obj))
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+
+		template <class T>
+		void write_packed(Tag tag, std::span<const T> values)
+		{
+			write_tag(tag);
+			write_raw(static_cast<uint64_t>(values.size()));
+			static constexpr char zeros[payload_alignment] = {};
+			write_bytes(zeros, (payload_alignment - _offset % payload_alignment) % payload_alignment);
+			write_bytes(values.data(), values.size_bytes());
+		}
+
+		// Writes a Ref to an already written object, otherwise numbers obj
+		bool write_reference(const Object* obj)
+		{
+			const auto [it, inserted] = _ids.try_emplace(obj, static_cast<uint32_t>(_ids.size()));
+			if (inserted)
+			{
+				return false;
+			}
+			write_tag(Tag::Ref);
+			write_raw(it->second);
+			return true;
+		}
+
+		void write_tag(Tag tag)
+		{
+			write_raw(tag);
+		}
+
+		template <class T>
+		void write_raw(const T& value)
+		{
+			write_bytes(&value, sizeof value);
+		}
+
+		void write_bytes(const void* data, size_t size)
+		{
+			if (size != 0 && fwrite(data, 1, size, _stream) != size)
+			{
+				_failed = true;
+			}
+			_offset += size;
+		}
+
+		FILE* _stream;
+		size_t _offset = 0;
+		bool _failed = false;
+		std::unordered_map<const Object*, uint32_t> _ids;
+	};
+
+	class Reader
+	{
+	public:
+		explicit Reader(std::shared_ptr<const MappedFile> file)
+			:_file(std::move(file))
+			,_content(_file->get_content())
+		{}
+
+		bool read_header()
+		{
+			Header header;
+			if (!read_raw(header) || header.magic != magic)
+			{
+				LOG_ERROR("Not a value file or saved on a host with different byte order");
+				return false;
+			}
+			if (header.version != version)
+			{
+				LOG_ERROR("Unsupported value file version {}, expected {}", header.version, version);
+				return false;
+			}
+			return true;
+		}
+
+		ObjectPtr read_value()
+		{
+			Tag tag;
+			if (!read_raw(tag))
+			{
+				return {};
+			}
+
+			switch (tag)
+			{
+			case Tag::Int:
+				{
+					int val;
+					if (!read_raw(val))
+					{
+						return {};
+					}
+					return Integer::make(val);
+				}
+			case Tag::Float:
+				{
+					float val;
+					if (!read_raw(val))
+					{
+						return {};
+					}
+					return make_object<Float>(val);
+				}
+			case Tag::Bool:
+				{
+					uint8_t val;
+					if (!read_raw(val))
+					{
+						return {};
+					}
+					return Bool::make(val != 0);
+				}
+			case Tag::String:
+				{
+					uint64_t size;
+					if (!read_raw(size) || !check_remaining(size))
+					{
+						return {};
+					}
+					auto str = make_object<String>(std::string{ _content.substr(_offset, size) });
+					_offset += size;
+					_objects.push_back(str);
+					return str;
+				}
+			case Tag::Array:				return read_array();
+			case Tag::IntArray:				return read_packed<int>(ElementType::Int);
+			case Tag::FloatArray:			return read_packed<float>(ElementType::Float);
+			case Tag::BoolArray:			return read_packed<uint8_t>(ElementType::Bool);
+			case Tag::Ref:
+				{
+					uint32_t id;
+					if (!read_raw(id))
+					{
+						return {};
+					}
+					if (id >= _objects.size())
+					{
+						LOG_ERROR("Value file references object {} before it is defined", id);
+						return {};
+					}
+					return _objects[id];
+				}
+			default:
+				LOG_ERROR("Unknown value tag {} at offset {}", static_cast<int>(tag), _offset - 1);
+				return {};
+			}
+		}
+
+	private:
+		ObjectPtr read_array()
+		{
+			uint64_t count;
+			// Every value takes at least one byte
+			if (!read_raw(count) || !check_remaining(count))
+			{
+				return {};
+			}
+
+			// Numbered before the elements, they may refer back to it
+			auto arr = make_object<ArrayObj>();
+			_objects.push_back(arr);
+			for (uint64_t i = 0; i < count; ++i)
+			{
+				auto element = read_value();
+				if (!element)
+				{
+					return {};
+				}
+				arr->append(std::move(element));
+			}
+			return arr;
+		}
+
+		template <class T>
+		ObjectPtr read_packed(ElementType type)
+		{
+			uint64_t count;
+			if (!read_raw(count))
+			{
+				return {};
+			}
+			_offset += (payload_alignment - _offset % payload_alignment) % payload_alignment;
+			if (_offset > _content.size() || count > (_content.size() - _offset) / sizeof(T))
+			{
+				report_truncated();
+				return {};
+			}
+
+			auto arr = make_object<ArrayObj>();
+			if (count != 0)
+			{
+				// Never written through, the array copies the elements before changing them
+				auto data = const_cast<char*>(_content.data() + _offset);
+				arr->assign_external(type, _file, data, count, false);
+				_offset += count * sizeof(T);
+			}
+			_objects.push_back(arr);
+			return arr;
+		}
+
+		template <class T>
+		bool read_raw(T& out)
+		{
+			if (!check_remaining(sizeof out))
+			{
+				return false;
+			}
+			std::memcpy(&out, _content.data() + _offset, sizeof out);
+			_offset += sizeof out;
+			return true;
+		}
+
+		bool check_remaining(uint64_t size)
+		{
+			if (size > _content.size() - _offset)
+			{
+				report_truncated();
+				return false;
+			}
+			return true;
+		}
+
+		void report_truncated()
+		{
+			LOG_ERROR("Value file is truncated at offset {}", _offset);
+		}
+
+		std::shared_ptr<const MappedFile> _file;
+		std::string_view _content;
+		size_t _offset = 0;
+		std::vector<ObjectPtr> _objects;
+	};
+
+	void report_io_error(const char* action, const std::string& path, int status)
+	{
+		char buff[256];
+		if (strerror_s(buff, sizeof buff, status) == 0)
+		{
+			LOG_ERROR("Failed to {} {}: {}", action, path, buff);
+		}
+	}
+}
+
+namespace serialize
+{
+	bool save(Object& value, const char* path)
+	{
+		// Written next to the target and renamed over it, a failed save keeps
+		// the old file and arrays still viewing it stay valid
+		const std::string temp_path = std::string{ path } + ".tmp";
+		FILE* stream;
+		const auto status = fopen_s(&stream, temp_path.c_str(), "wb");
+		if (status != 0)
+		{
+			report_io_error("open", temp_path, status);
+			return false;
+		}
+
+		Writer writer{ stream };
+		const bool written = writer.write_value(value);
+		const bool closed = fclose(stream) == 0;
+		if (!written || !closed || writer.failed())
+		{
+			if (written)
+			{
+				LOG_ERROR("Failed to write {}", temp_path);
+			}
+			std::remove(temp_path.c_str());
+			return false;
+		}
+
+		std::error_code error;
+		std::filesystem::rename(temp_path, path, error);
+		if (error)
+		{
+			LOG_ERROR("Failed to replace {}: {}", path, error.message());
+			std::remove(temp_path.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	ObjectPtr load(const char* path)
+	{
+		auto file = std::make_shared<MappedFile>();
+		if (!file->open(path))
+		{
+			return {};
+		}
+
+		Reader reader{ std::move(file) };
+		if (!reader.read_header())
+		{
+			return {};
+		}
+		return reader.read_value();
+	}
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "object.hpp"
+
+// Versioned binary format for script values. A file holds a header and one
+// typed, length prefixed value: integers, floats, bools, strings and arrays,
+// nested arrays included. Strings and arrays seen twice are written once and
+// referenced afterwards, so shared and cyclic values keep their shape.
+// Numbers are stored in host byte order, the header rejects other hosts.
+//
+// Packed int, float and bool arrays are aligned in the file and loaded
+// without copying: they view the mapped file until first changed, which
+// keeps the file mapped while any of them is alive.
+namespace serialize
+{
+	// Failures are logged, the previous file is only replaced on success
+	bool save(Object& value, const char* path);
+
+	// Null when the file can't be read or is not a valid value file
+	ObjectPtr load(const char* path);
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+// SSE2 is part of every x64 target, 32 bit MSVC builds need /arch:SSE2
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HAS_SSE2 1
+#include <emmintrin.h>
+#else
+#define HAS_SSE2 0
+#endif
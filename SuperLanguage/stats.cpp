@@ -0,0 +1,182 @@
+#include "stats.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <format>
+#include <mutex>
+#include <string_view>
+
+#include "thread_slots.hpp"
+
+namespace
+{
+	constexpr std::string_view counter_names[] = {
+		"BinaryOperation +", "BinaryOperation -", "BinaryOperation *", "BinaryOperation /",
+		"BinaryOperation >", "BinaryOperation <", "BinaryOperation =", "BinaryOperation >=",
+		"BinaryOperation <=",
+		"Scope", "Variable read", "Assign", "StackValue", "ArrayNode", "Call", "Native call",
+		"Spawn", "Return", "Yield", "BranchIfElse", "Loop iteration", "ForRange iteration"
+	};
+	static_assert(std::size(counter_names) == static_cast<size_t>(stats::Counter::Count));
+
+	// Object classes beyond this share the last slot
+	constexpr size_t max_types = 32;
+
+	// Written by the owning thread only, atomics let reports read them meanwhile
+	struct ThreadCounters
+	{
+		std::array<std::atomic<uint64_t>, static_cast<size_t>(stats::Counter::Count)> nodes{};
+		std::array<std::atomic<uint64_t>, max_types> allocations{};
+		std::atomic<size_t> max_stack_size = 0;
+		std::atomic<size_t> max_call_depth = 0;
+	};
+
+	// Counters of ended threads stay in the reports
+	using Counters = ThreadSlots<ThreadCounters>;
+
+	struct TypeNames
+	{
+		std::mutex mutex;
+		std::vector<std::string> names;
+	};
+
+	TypeNames& get_type_names()
+	{
+		static TypeNames type_names;
+		return type_names;
+	}
+
+	void increment(std::atomic<uint64_t>& counter)
+	{
+		counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+
+	void raise(std::atomic<size_t>& mark, size_t value)
+	{
+		if (value > mark.load(std::memory_order_relaxed))
+		{
+			mark.store(value, std::memory_order_relaxed);
+		}
+	}
+
+	// typeid names are "class ArrayObj" on MSVC and "8ArrayObj" on GCC and Clang
+	std::string get_class_name(std::string_view name)
+	{
+		for (const std::string_view prefix : { "class ", "struct " })
+		{
+			if (name.starts_with(prefix))
+			{
+				name.remove_prefix(prefix.size());
+			}
+		}
+		while (!name.empty() && name.front() >= '0' && name.front() <= '9')
+		{
+			name.remove_prefix(1);
+		}
+		return std::string{ name };
+	}
+
+	void sort_entries(std::vector<stats::Entry>& entries)
+	{
+		std::erase_if(entries, [](const auto& entry) { return entry.count == 0; });
+		std::ranges::stable_sort(entries, [](const auto& l, const auto& r) { return l.count > r.count; });
+	}
+}
+
+namespace stats
+{
+	void count(Counter counter)
+	{
+		increment(Counters::get_local().nodes[static_cast<size_t>(counter)]);
+	}
+
+	void count_allocation(size_t type_slot)
+	{
+		increment(Counters::get_local().allocations[type_slot]);
+	}
+
+	void record_stack(size_t stack_size, size_t call_depth)
+	{
+		auto& local = Counters::get_local();
+		raise(local.max_stack_size, stack_size);
+		raise(local.max_call_depth, call_depth);
+	}
+
+	size_t register_type(const char* type_name)
+	{
+		auto& type_names = get_type_names();
+		std::lock_guard lock{ type_names.mutex };
+		if (type_names.names.size() == max_types - 1)
+		{
+			type_names.names.emplace_back("other");
+		}
+		if (type_names.names.size() == max_types)
+		{
+			return max_types - 1;
+		}
+		type_names.names.push_back(get_class_name(type_name));
+		return type_names.names.size() - 1;
+	}
+
+	Report collect()
+	{
+		Report report;
+		for (size_t i = 0; i < std::size(counter_names); ++i)
+		{
+			report.nodes.push_back({ std::string{ counter_names[i] }, 0 });
+		}
+		{
+			auto& type_names = get_type_names();
+			std::lock_guard lock{ type_names.mutex };
+			for (const auto& name : type_names.names)
+			{
+				report.allocations.push_back({ name, 0 });
+			}
+		}
+
+		Counters::for_each([&report](size_t, const ThreadCounters& thread)
+			{
+				for (size_t i = 0; i < report.nodes.size(); ++i)
+				{
+					report.nodes[i].count += thread.nodes[i].load(std::memory_order_relaxed);
+				}
+				for (size_t i = 0; i < report.allocations.size(); ++i)
+				{
+					report.allocations[i].count += thread.allocations[i].load(std::memory_order_relaxed);
+				}
+				report.max_stack_size = std::max(report.max_stack_size, thread.max_stack_size.load(std::memory_order_relaxed));
+				report.max_call_depth = std::max(report.max_call_depth, thread.max_call_depth.load(std::memory_order_relaxed));
+			});
+
+		sort_entries(report.nodes);
+		sort_entries(report.allocations);
+		return report;
+	}
+
+	void write_report(FILE* stream)
+	{
+		const auto report = collect();
+		auto write_entries = [stream](std::string_view title, const std::vector<Entry>& entries)
+		{
+			uint64_t total = 0;
+			for (const auto& entry : entries)
+			{
+				total += entry.count;
+			}
+
+			const auto header = std::format("\n{:>14} {:>7}  {}\n", "count", "share", title);
+			fputs(header.c_str(), stream);
+			for (const auto& entry : entries)
+			{
+				const auto line = std::format("{:>14} {:>6.1f}%  {}\n", entry.count, 100.0 * entry.count / total, entry.name);
+				fputs(line.c_str(), stream);
+			}
+		};
+
+		write_entries("node", report.nodes);
+		write_entries("allocation", report.allocations);
+		const auto marks = std::format("\nstack high water mark: {} values, {} calls deep\n", report.max_stack_size, report.max_call_depth);
+		fputs(marks.c_str(), stream);
+	}
+}
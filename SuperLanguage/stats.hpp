@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <typeinfo>
+#include <vector>
+
+// Execution counters for --stats, set to 0 to build without them
+#define COLLECT_STATS 1
+
+// Counts of executed nodes, allocations per object class and stack high
+// water marks. Every thread counts on its own, reports add up all threads
+// that ever counted. Nothing is counted unless enabled.
+namespace stats
+{
+	enum class Counter
+	{
+		// Same order as Operation
+		Plus,
+		Minus,
+		Mul,
+		Div,
+		Greater,
+		Less,
+		Equal,
+		EqualGreater,
+		EqualLess,
+
+		Scope,
+		VariableRead,
+		Assign,
+		Value,
+		ArrayLiteral,
+		Call,
+		NativeCall,
+		Spawn,
+		Return,
+		Yield,
+		Branch,
+		LoopIteration,
+		ForIteration,
+
+		Count
+	};
+
+	// Set before the script starts, read by every thread
+	inline bool enabled = false;
+
+	struct Entry
+	{
+		std::string name;
+		uint64_t count;
+	};
+
+	struct Report
+	{
+		// Most frequent first
+		std::vector<Entry> nodes;
+		std::vector<Entry> allocations;
+		size_t max_stack_size = 0;
+		size_t max_call_depth = 0;
+	};
+
+	void count(Counter counter);
+
+	void count_allocation(size_t type_slot);
+
+	void record_stack(size_t stack_size, size_t call_depth);
+
+	// Slot of an object class, numbered on first use
+	size_t register_type(const char* type_name);
+
+	template <class T>
+	size_t get_type_slot()
+	{
+		static const size_t slot = register_type(typeid(T).name());
+		return slot;
+	}
+
+	Report collect();
+
+	void write_report(FILE* stream);
+}
+
+#if (COLLECT_STATS)
+#define STATS_COUNT(counter) \
+	{ \
+		if (stats::enabled) \
+		{ \
+			stats::count(counter); \
+		} \
+	}
+#define STATS_ALLOCATION(type) \
+	{ \
+		if (stats::enabled) \
+		{ \
+			stats::count_allocation(stats::get_type_slot<type>()); \
+		} \
+	}
+#define STATS_STACK(stack_size, call_depth) \
+	{ \
+		if (stats::enabled) \
+		{ \
+			stats::record_stack(stack_size, call_depth); \
+		} \
+	}
+#else
+#define STATS_COUNT(counter)
+#define STATS_ALLOCATION(type)
+#define STATS_STACK(stack_size, call_depth)
+#endif
@@ -0,0 +1,91 @@
+#include "string_kernels.hpp"
+
+#include <bit>
+#include <cstdint>
+#include <cstring>
+
+#include "simd.hpp"
+
+namespace string_kernels
+{
+	size_t find(std::string_view str, std::string_view needle, size_t from)
+	{
+		if (from > str.size() || needle.size() > str.size() - from)
+		{
+			return std::string_view::npos;
+		}
+		if (needle.empty())
+		{
+			return from;
+		}
+
+		const char* begin = str.data();
+		const char* pos = begin + from;
+		// Last position a match can start at
+		const char* last = begin + str.size() - needle.size();
+
+#if HAS_SSE2
+		// Compares the first and the last needle character at 16 positions at
+		// once, only positions matching both are checked in full.
+		if (needle.size() > 1)
+		{
+			const __m128i first = _mm_set1_epi8(needle.front());
+			const __m128i final = _mm_set1_epi8(needle.back());
+			for (; pos + 15 <= last; pos += 16)
+			{
+				const __m128i block_first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pos));
+				const __m128i block_last = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pos + needle.size() - 1));
+				auto mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, block_first), _mm_cmpeq_epi8(final, block_last))));
+				while (mask != 0)
+				{
+					const auto offset = std::countr_zero(mask);
+					if (std::memcmp(pos + offset + 1, needle.data() + 1, needle.size() - 2) == 0)
+					{
+						return pos + offset - begin;
+					}
+					mask &= mask - 1;
+				}
+			}
+		}
+#endif
+
+		// memchr is vectorized by the C runtime
+		while (pos <= last)
+		{
+			pos = static_cast<const char*>(std::memchr(pos, needle.front(), last - pos + 1));
+			if (!pos)
+			{
+				break;
+			}
+			if (std::memcmp(pos + 1, needle.data() + 1, needle.size() - 1) == 0)
+			{
+				return pos - begin;
+			}
+			++pos;
+		}
+		return std::string_view::npos;
+	}
+
+	std::vector<std::string_view> split(std::string_view str, std::string_view separator)
+	{
+		std::vector<std::string_view> parts;
+		if (separator.empty())
+		{
+			parts.push_back(str);
+			return parts;
+		}
+
+		size_t from = 0;
+		while (true)
+		{
+			const auto pos = find(str, separator, from);
+			if (pos == std::string_view::npos)
+			{
+				parts.push_back(str.substr(from));
+				return parts;
+			}
+			parts.push_back(str.substr(from, pos - from));
+			from = pos + separator.size();
+		}
+	}
+}
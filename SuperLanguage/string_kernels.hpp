@@ -0,0 +1,14 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+
+namespace string_kernels
+{
+	// Position of needle at or after from, npos when missing
+	size_t find(std::string_view str, std::string_view needle, size_t from = 0);
+
+	// Parts between separators, empty parts included. Parts view into str,
+	// an empty separator gives str back whole.
+	std::vector<std::string_view> split(std::string_view str, std::string_view separator);
+}
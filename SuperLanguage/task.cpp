@@ -0,0 +1,40 @@
+#include "task.hpp"
+
+#include <memory>
+
+#include "scheduler.hpp"
+
+Ref<TaskObj> TaskObj::spawn(Interpreter* interp, Function* func, std::vector<ObjectPtr> args)
+{
+	// Reached from the worker thread too, keep it off the collector heap
+	Heap::Guard heap_guard{ nullptr };
+	auto task = make_object<TaskObj>();
+	task->mark_shared();
+	for (const auto& arg : args)
+	{
+		arg->mark_shared();
+	}
+
+	// Created here, the function table of interp is only read on its own thread
+	std::shared_ptr<Interpreter> worker = interp->make_worker();
+	Scheduler::get_default().submit([task, worker, func, args = std::move(args)]
+		{
+			auto result = worker->call_function(func, args);
+			if (result)
+			{
+				result->mark_shared();
+			}
+			task->_result = std::move(result);
+			task->_done.store(true, std::memory_order_release);
+		});
+	return task;
+}
+
+ObjectPtr TaskObj::await()
+{
+	if (!is_done())
+	{
+		Scheduler::get_default().wait_until([this] { return is_done(); });
+	}
+	return _result;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+
+#include "interpreter.hpp"
+
+// Handle of a script function running on the default scheduler. The
+// function runs on its own worker interpreter over the shared program, so
+// arguments and the result are shared between threads.
+class TaskObj final : public Object
+{
+public:
+	// Starts func(args), functions defined so far in interp can be called
+	static Ref<TaskObj> spawn(Interpreter* interp, Function* func, std::vector<ObjectPtr> args);
+
+	bool get(TaskObj** val) override { (*val) = this; return true; }
+
+	bool is_done() const { return _done.load(std::memory_order_acquire); }
+
+	// Waits for the function to finish, running other tasks meanwhile. Null
+	// when the function returned nothing.
+	ObjectPtr await();
+
+private:
+	std::atomic<bool> _done = false;
+	ObjectPtr _result;
+};
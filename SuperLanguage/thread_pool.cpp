@@ -0,0 +1,112 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(size_t threads)
+{
+	_threads.reserve(threads);
+	for (size_t i = 0; i < threads; ++i)
+	{
+		_threads.emplace_back([this] { worker_loop(); });
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard lock{ _mutex };
+		_stop = true;
+	}
+	_wake.notify_all();
+	for (auto& thread : _threads)
+	{
+		// exit() called from a pool thread destroys the pool on that thread
+		if (thread.get_id() == std::this_thread::get_id())
+		{
+			thread.detach();
+			continue;
+		}
+		thread.join();
+	}
+}
+
+ThreadPool& ThreadPool::get_default()
+{
+	static ThreadPool pool{ std::max(std::thread::hardware_concurrency(), 1u) - 1 };
+	return pool;
+}
+
+void ThreadPool::run(size_t count, const Task& task)
+{
+	if (count < 2 || _threads.empty() || _busy.exchange(true, std::memory_order_acquire))
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			task(i);
+		}
+		return;
+	}
+
+	{
+		std::lock_guard lock{ _mutex };
+		_task = &task;
+		_next = 0;
+		_count = count;
+		_pending = count;
+	}
+	_wake.notify_all();
+
+	while (run_next())
+	{
+	}
+
+	{
+		std::unique_lock lock{ _mutex };
+		_done.wait(lock, [this] { return _pending == 0; });
+		_task = nullptr;
+	}
+	_busy.store(false, std::memory_order_release);
+}
+
+void ThreadPool::worker_loop()
+{
+	while (true)
+	{
+		{
+			std::unique_lock lock{ _mutex };
+			_wake.wait(lock, [this] { return _stop || (_task && _next < _count); });
+			if (_stop)
+			{
+				return;
+			}
+		}
+
+		while (run_next())
+		{
+		}
+	}
+}
+
+bool ThreadPool::run_next()
+{
+	const Task* task;
+	size_t index;
+	{
+		std::lock_guard lock{ _mutex };
+		if (!_task || _next >= _count)
+		{
+			return false;
+		}
+		task = _task;
+		index = _next++;
+	}
+
+	(*task)(index);
+
+	std::lock_guard lock{ _mutex };
+	if (--_pending == 0)
+	{
+		_done.notify_all();
+	}
+	return true;
+}
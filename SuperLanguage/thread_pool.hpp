@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads running one batch of indexed tasks at a time.
+// The calling thread takes part in the batch and returns when all tasks are
+// done. A batch started while another one runs, e.g. from inside a task, is
+// run inline on the calling thread.
+class ThreadPool
+{
+public:
+	using Task = std::function<void(size_t)>;
+
+	explicit ThreadPool(size_t threads);
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+	~ThreadPool();
+
+	// Shared pool with one thread per core, the caller being one of them
+	static ThreadPool& get_default();
+
+	// Threads working on a batch, including the caller
+	size_t get_concurrency() const { return _threads.size() + 1; }
+
+	// Calls task(i) for every i in [0, count)
+	void run(size_t count, const Task& task);
+
+private:
+	void worker_loop();
+
+	bool run_next();
+
+	std::vector<std::thread> _threads;
+	std::atomic<bool> _busy = false;
+	std::mutex _mutex;
+	std::condition_variable _wake;
+	std::condition_variable _done;
+	const Task* _task = nullptr;
+	size_t _next = 0;
+	size_t _count = 0;
+	size_t _pending = 0;
+	bool _stop = false;
+};
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// One T per thread, made on first use and kept after the thread ends so
+// what it recorded can still be read. Only the owning thread writes its
+// slot, readers go through for_each and need T to tolerate that, e.g.
+// with atomics. Every T has a single registry.
+template <class T>
+class ThreadSlots
+{
+public:
+	ThreadSlots() = delete;
+
+	// Takes the registry lock on the first call of a thread only
+	static T& get_local()
+	{
+		thread_local T* local = nullptr;
+		if (!local)
+		{
+			auto& registry = get_registry();
+			std::lock_guard lock{ registry.mutex };
+			local = registry.slots.emplace_back(std::make_unique<T>()).get();
+		}
+		return *local;
+	}
+
+	// Calls f(index, slot) for every slot in the order the threads made them
+	template <class F>
+	static void for_each(F&& f)
+	{
+		auto& registry = get_registry();
+		std::lock_guard lock{ registry.mutex };
+		for (size_t i = 0; i < registry.slots.size(); ++i)
+		{
+			f(i, *registry.slots[i]);
+		}
+	}
+
+private:
+	struct Registry
+	{
+		std::mutex mutex;
+		std::vector<std::unique_ptr<T>> slots;
+	};
+
+	static Registry& get_registry()
+	{
+		static Registry registry;
+		return registry;
+	}
+};
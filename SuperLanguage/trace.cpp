@@ -0,0 +1,124 @@
+#include "trace.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <format>
+#include <memory>
+#include <string>
+
+#include "thread_slots.hpp"
+
+namespace
+{
+	using Clock = std::chrono::steady_clock;
+
+	const auto start_time = Clock::now();
+
+	constexpr std::string_view category_names[] = { "call", "builtin", "lexer", "parser" };
+
+	struct Event
+	{
+		const char* name;
+		uint32_t name_size;
+		trace::Category category;
+		char phase;
+		int64_t time_ns;
+	};
+
+	// Written by the owning thread only, the oldest events are overwritten
+	struct Ring
+	{
+		static constexpr size_t capacity = 1 << 16;
+
+		std::unique_ptr<Event[]> events = std::make_unique<Event[]>(capacity);
+		std::atomic<uint64_t> head = 0;
+	};
+
+	// Rings of ended threads are written at exit too
+	using Rings = ThreadSlots<Ring>;
+
+	void record(trace::Category category, std::string_view name, char phase)
+	{
+		const auto time = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start_time);
+		auto& ring = Rings::get_local();
+		const auto head = ring.head.load(std::memory_order_relaxed);
+		ring.events[head % Ring::capacity] = { name.data(), static_cast<uint32_t>(name.size()), category, phase, time.count() };
+		ring.head.store(head + 1, std::memory_order_release);
+	}
+
+	void write_escaped(std::string& out, std::string_view str)
+	{
+		for (const char c : str)
+		{
+			if (c == '"' || c == '\\')
+			{
+				out += '\\';
+				out += c;
+			}
+			else if (static_cast<unsigned char>(c) < 0x20)
+			{
+				out += ' ';
+			}
+			else
+			{
+				out += c;
+			}
+		}
+	}
+}
+
+namespace trace
+{
+	void begin(Category category, std::string_view name)
+	{
+		record(category, name, 'B');
+	}
+
+	void end(Category category, std::string_view name)
+	{
+		record(category, name, 'E');
+	}
+
+	void write(FILE* stream)
+	{
+		fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n", stream);
+		bool first = true;
+		std::string line;
+		Rings::for_each([&](size_t tid, const Ring& ring)
+			{
+				const auto head = ring.head.load(std::memory_order_acquire);
+				const auto tail = head > Ring::capacity ? head - Ring::capacity : 0;
+
+				line = std::format("{}{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":{},\"args\":{{\"name\":\"thread {}\"}}}}",
+					first ? "" : ",\n", tid, tid);
+				fputs(line.c_str(), stream);
+				first = false;
+
+				// Ends whose begin was overwritten would close frames of the viewer
+				size_t depth = 0;
+				for (auto i = tail; i < head; ++i)
+				{
+					const auto& event = ring.events[i % Ring::capacity];
+					if (event.phase == 'E')
+					{
+						if (depth == 0)
+						{
+							continue;
+						}
+						--depth;
+					}
+					else
+					{
+						++depth;
+					}
+
+					line = ",\n{\"name\":\"";
+					write_escaped(line, { event.name, event.name_size });
+					line += std::format("\",\"cat\":\"{}\",\"ph\":\"{}\",\"pid\":1,\"tid\":{},\"ts\":{}}}",
+						category_names[static_cast<size_t>(event.category)], event.phase, tid, event.time_ns / 1000.0);
+					fputs(line.c_str(), stream);
+				}
+			});
+		fputs("\n]}\n", stream);
+	}
+}
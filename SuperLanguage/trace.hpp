@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string_view>
+
+// Timeline of script calls, builtins, lexing and parsing for --trace,
+// written as Chrome trace events for Perfetto or chrome://tracing. Every
+// thread records into a ring buffer of its own, so recording takes no lock
+// and a long run keeps its latest events. Names are not copied, they must
+// outlive the write.
+namespace trace
+{
+	enum class Category : uint8_t
+	{
+		Call,
+		Builtin,
+		Lexer,
+		Parser
+	};
+
+	// Set before any thread starts, read by every thread
+	inline bool enabled = false;
+
+	void begin(Category category, std::string_view name);
+
+	void end(Category category, std::string_view name);
+
+	// Events recorded so far, threads that still record may lose their latest ones
+	void write(FILE* stream);
+
+	// Begin and end event around a block
+	class Span
+	{
+	public:
+		Span(Category category, std::string_view name)
+			:_category(category)
+			,_name(name)
+			,_active(enabled)
+		{
+			if (_active)
+			{
+				begin(_category, _name);
+			}
+		}
+
+		Span(const Span&) = delete;
+		Span& operator=(const Span&) = delete;
+
+		~Span()
+		{
+			if (_active)
+			{
+				end(_category, _name);
+			}
+		}
+
+	private:
+		Category _category;
+		std::string_view _name;
+		bool _active;
+	};
+}
@@ -2,6 +2,12 @@
 
 #include <iostream>
 
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
 
 std::vector<std::string> split_by_lines(const std::string& str)
 {
@@ -92,4 +98,13 @@ std::optional<std::string> readFile(const char* fileName)
 	}
 
 	return {};
+}
+
+bool is_terminal(FILE* stream)
+{
+#ifdef _WIN32
+	return _isatty(_fileno(stream)) != 0;
+#else
+	return isatty(fileno(stream)) != 0;
+#endif
 }
\ No newline at end of file
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdio>
 #include <optional>
 #include <string>
 #include <vector>
@@ -8,4 +9,6 @@ std::vector<std::string> split_by_lines(const std::string& str);
 
 bool is_digit(const char* str);
 
-std::optional<std::string> readFile(const char* fileName);
\ No newline at end of file
+std::optional<std::string> readFile(const char* fileName);
+
+bool is_terminal(FILE* stream);
\ No newline at end of file